@@ -0,0 +1,175 @@
+#include "boolean_query.h"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    // Parentheses are tokens of their own even when attached to a word, and a
+    // quoted phrase is one token with its quotes, or up to the end if unclosed
+    std::vector<std::string_view> SplitIntoTokens(std::string_view text) {
+        std::vector<std::string_view> tokens;
+        size_t position = 0;
+        while (position < text.size()) {
+            if (text[position] == ' ') {
+                ++position;
+            }
+            else if (text[position] == '(' || text[position] == ')') {
+                tokens.push_back(text.substr(position, 1));
+                ++position;
+            }
+            else if (text[position] == '"') {
+                const size_t end = text.find('"', position + 1);
+                tokens.push_back(text.substr(position, end == std::string_view::npos ? end : end + 1 - position));
+                position = end == std::string_view::npos ? text.size() : end + 1;
+            }
+            else {
+                const size_t end = text.find_first_of(" ()\"", position);
+                tokens.push_back(text.substr(position, end - position));
+                position = end == std::string_view::npos ? text.size() : end;
+            }
+        }
+        return tokens;
+    }
+
+    bool IsOperator(std::string_view token) {
+        return token == "AND" || token == "OR" || token == "NOT";
+    }
+
+    class BooleanQueryParser {
+    public:
+        explicit BooleanQueryParser(std::vector<std::string_view> tokens) : tokens_(std::move(tokens)) {
+        }
+
+        BooleanQueryNode Parse() {
+            BooleanQueryNode root = ParseExpression();
+            if (position_ != tokens_.size()) {
+                throw std::invalid_argument("Unbalanced parentheses in boolean query");
+            }
+            return root;
+        }
+
+    private:
+        std::vector<std::string_view> tokens_;
+        size_t position_ = 0;
+
+        bool IsAt(std::string_view token) const {
+            return position_ < tokens_.size() && tokens_[position_] == token;
+        }
+
+        // Adjacent operands without an operator are joined by OR
+        BooleanQueryNode ParseExpression() {
+            BooleanQueryNode node = ParseConjunction();
+            while (position_ < tokens_.size() && !IsAt(")")) {
+                if (IsAt("OR")) {
+                    ++position_;
+                }
+                node = Join(BooleanQueryNode::Kind::OR, std::move(node), ParseConjunction());
+            }
+            return node;
+        }
+
+        BooleanQueryNode ParseConjunction() {
+            BooleanQueryNode node = ParseUnary();
+            while (IsAt("AND")) {
+                ++position_;
+                node = Join(BooleanQueryNode::Kind::AND, std::move(node), ParseUnary());
+            }
+            return node;
+        }
+
+        BooleanQueryNode ParseUnary() {
+            if (position_ == tokens_.size() || IsAt(")") || IsAt("AND") || IsAt("OR")) {
+                throw std::invalid_argument("Missing operand in boolean query");
+            }
+            const std::string_view token = tokens_[position_++];
+            if (token == "NOT") {
+                BooleanQueryNode node = MakeNode(BooleanQueryNode::Kind::NOT);
+                node.children.push_back(ParseUnary());
+                return node;
+            }
+            if (token == "(") {
+                BooleanQueryNode node = ParseExpression();
+                if (!IsAt(")")) {
+                    throw std::invalid_argument("Unbalanced parentheses in boolean query");
+                }
+                ++position_;
+                return node;
+            }
+            if (token[0] == '"') {
+                return ParsePhrase(token);
+            }
+            return ParseWord(token);
+        }
+
+        // Only WORD nodes take the word
+        static BooleanQueryNode MakeNode(BooleanQueryNode::Kind kind, std::string_view word = {}) {
+            BooleanQueryNode node;
+            node.kind = kind;
+            node.word = word;
+            return node;
+        }
+
+        static BooleanQueryNode ParseWord(std::string_view token) {
+            if (token[0] == '-' || token[0] == '+') {
+                throw std::invalid_argument("Denied word prefix in boolean query");
+            }
+            return MakeNode(BooleanQueryNode::Kind::WORD, token);
+        }
+
+        // Inside quotes only spaces separate words; operators are plain words there
+        static BooleanQueryNode ParsePhrase(std::string_view token) {
+            if (token.size() < 2 || token.back() != '"') {
+                throw std::invalid_argument("Unbalanced quotes in boolean query");
+            }
+            const std::string_view text = token.substr(1, token.size() - 2);
+            BooleanQueryNode node = MakeNode(BooleanQueryNode::Kind::PHRASE);
+            size_t position = 0;
+            while (position < text.size()) {
+                const size_t end = std::min(text.find(' ', position), text.size());
+                if (end != position) {
+                    node.children.push_back(ParseWord(text.substr(position, end - position)));
+                    if (node.children.back().word.back() == '*') {
+                        throw std::invalid_argument("Denied prefix in phrase");
+                    }
+                }
+                position = end + 1;
+            }
+            if (node.children.empty()) {
+                throw std::invalid_argument("Empty phrase in boolean query");
+            }
+            return node;
+        }
+
+        static BooleanQueryNode Join(BooleanQueryNode::Kind kind, BooleanQueryNode lhs, BooleanQueryNode rhs) {
+            if (lhs.kind != kind) {
+                BooleanQueryNode node = MakeNode(kind);
+                node.children.push_back(std::move(lhs));
+                lhs = std::move(node);
+            }
+            if (rhs.kind == kind) {
+                for (auto& child : rhs.children) {
+                    lhs.children.push_back(std::move(child));
+                }
+            }
+            else {
+                lhs.children.push_back(std::move(rhs));
+            }
+            return lhs;
+        }
+    };
+}
+
+std::optional<BooleanQueryNode> ParseBooleanQuery(std::string_view text) {
+    const std::vector<std::string_view> tokens = SplitIntoTokens(text);
+    if (std::none_of(tokens.begin(), tokens.end(), [](const std::string_view token) {
+        return token == "(" || token == ")" || token[0] == '"' || IsOperator(token);
+    })) {
+        return std::nullopt;
+    }
+    try {
+        return BooleanQueryParser(tokens).Parse();
+    }
+    catch (const std::invalid_argument&) {
+        return std::nullopt;
+    }
+}
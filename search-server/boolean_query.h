@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Operator tree of a boolean query such as "(cat OR dog) AND NOT collar".
+// NOT binds tighter than AND, and AND tighter than OR. Words written next to
+// each other without an operator are joined by OR, as in plain queries.
+// Words in double quotes form a phrase: they must appear next to each other
+// in that order, with stop words between them standing for any one word.
+struct BooleanQueryNode {
+    enum class Kind : uint8_t {
+        WORD,
+        AND,
+        OR,
+        NOT,
+        PHRASE,
+    };
+
+    Kind kind = Kind::WORD;
+    // Only for WORD
+    std::string_view word;
+    // Two or more for AND and OR, one for NOT, the words in order for PHRASE;
+    // nested AND and OR are flattened
+    std::vector<BooleanQueryNode> children;
+};
+
+// A query is boolean if it has parentheses, quotes or one of the upper case
+// operators AND, OR and NOT as a separate word, and is well formed. Nothing is
+// returned otherwise, and the query stays a plain one where these are ordinary
+// words: "NOT" or "cat AND" as well as queries with unbalanced parentheses or
+// quotes, missing operands, empty phrases, prefixes ("word*") in phrases and
+// words with the '-' or '+' prefixes of plain queries.
+std::optional<BooleanQueryNode> ParseBooleanQuery(std::string_view text);
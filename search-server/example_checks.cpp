@@ -0,0 +1,11 @@
+#include "test_example_functions.h"
+
+int main() {
+    test_remove_and_compact();
+    test_required_words();
+    test_boolean_queries();
+    test_phrase_queries();
+    test_prefix_queries();
+    cout << "All checks passed"s << endl;
+    return 0;
+}
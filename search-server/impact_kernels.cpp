@@ -0,0 +1,56 @@
+#include "impact_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMPACT_KERNELS_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+    void AccumulateImpactsScalar(const uint32_t* ordinals, const uint16_t* impacts, size_t count, uint32_t weight,
+                                 uint32_t* scores) {
+        for (size_t i = 0; i < count; ++i) {
+            scores[ordinals[i]] += impacts[i] * weight;
+        }
+    }
+
+#ifdef IMPACT_KERNELS_AVX2
+    // AVX2 has gathers but no scatters, so the sums are written back lane by
+    // lane; distinct ordinals make that safe
+    __attribute__((target("avx2")))
+    void AccumulateImpactsAvx2(const uint32_t* ordinals, const uint16_t* impacts, size_t count, uint32_t weight,
+                               uint32_t* scores) {
+        const __m256i weights = _mm256_set1_epi32(static_cast<int>(weight));
+        alignas(32) uint32_t sums[8];
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ordinals + i));
+            const __m256i lane_impacts = _mm256_cvtepu16_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(impacts + i)));
+            const __m256i lane_scores = _mm256_i32gather_epi32(reinterpret_cast<const int*>(scores), indices, 4);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(sums),
+                               _mm256_add_epi32(lane_scores, _mm256_mullo_epi32(lane_impacts, weights)));
+            for (size_t lane = 0; lane < 8; ++lane) {
+                scores[ordinals[i + lane]] = sums[lane];
+            }
+        }
+        AccumulateImpactsScalar(ordinals + i, impacts + i, count - i, weight, scores);
+    }
+#endif
+
+    using AccumulateImpactsKernel = void (*)(const uint32_t*, const uint16_t*, size_t, uint32_t, uint32_t*);
+
+    AccumulateImpactsKernel SelectKernel() {
+#ifdef IMPACT_KERNELS_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            return AccumulateImpactsAvx2;
+        }
+#endif
+        return AccumulateImpactsScalar;
+    }
+}
+
+void AccumulateImpacts(const uint32_t* ordinals, const uint16_t* impacts, size_t count, uint32_t weight,
+                       uint32_t* scores) {
+    static const AccumulateImpactsKernel kernel = SelectKernel();
+    kernel(ordinals, impacts, count, weight, scores);
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Adds impacts[i] * weight to scores[ordinals[i]] for i < count. The ordinals
+// must be distinct. Uses AVX2 gathers when the CPU supports them, which is
+// checked once at run time, and a scalar loop otherwise.
+void AccumulateImpacts(const uint32_t* ordinals, const uint16_t* impacts, size_t count, uint32_t weight,
+                       uint32_t* scores);
@@ -0,0 +1,242 @@
+#include "posting_list.h"
+#include <algorithm>
+#include <bit>
+#include <numeric>
+
+namespace {
+    // BLOCK_SIZE is a multiple of 32, so a packed block fills whole words
+    void PackBlock(const uint32_t* values, uint32_t bit_width, uint32_t* packed) {
+        for (size_t i = 0; i < PostingList::BLOCK_SIZE && bit_width != 0; ++i) {
+            const size_t bit = i * bit_width;
+            packed[bit / 32] |= values[i] << (bit % 32);
+            if (bit % 32 + bit_width > 32) {
+                packed[bit / 32 + 1] |= values[i] >> (32 - bit % 32);
+            }
+        }
+    }
+
+    void UnpackBlock(const uint32_t* packed, uint32_t bit_width, uint32_t* values) {
+        if (bit_width == 0) {
+            std::fill(values, values + PostingList::BLOCK_SIZE, 0);
+            return;
+        }
+        const uint32_t mask = bit_width == 32 ? UINT32_MAX : (uint32_t{1} << bit_width) - 1;
+        for (size_t i = 0; i < PostingList::BLOCK_SIZE; ++i) {
+            const size_t bit = i * bit_width;
+            uint32_t value = packed[bit / 32] >> (bit % 32);
+            if (bit % 32 + bit_width > 32) {
+                value |= packed[bit / 32 + 1] << (32 - bit % 32);
+            }
+            values[i] = value & mask;
+        }
+    }
+}
+
+PostingList::Cursor::Cursor(const PostingList& postings) : postings_(&postings) {
+    LoadBlock();
+}
+
+uint32_t PostingList::Cursor::GetOrdinal() const {
+    return position_ < postings_->size() ? GetBlockOrdinals()[position_ % BLOCK_SIZE] : END_ORDINAL;
+}
+
+uint32_t PostingList::Cursor::GetTermCount() const {
+    return GetBlockTermCounts()[position_ % BLOCK_SIZE];
+}
+
+void PostingList::Cursor::Next() {
+    if (++position_ % BLOCK_SIZE == 0) {
+        LoadBlock();
+    }
+}
+
+void PostingList::Cursor::SkipTo(uint32_t target) {
+    if (GetOrdinal() >= target) {
+        return;
+    }
+    // Gallop over the last ordinals of the blocks with doubling steps, so that
+    // a far target costs logarithmically many headers, then search inside the block
+    size_t block = position_ / BLOCK_SIZE;
+    const size_t block_count = postings_->GetBlockCount();
+    if (postings_->GetBlockLastOrdinal(block) < target) {
+        size_t passed = block;
+        size_t step = 1;
+        while (passed + step < block_count && postings_->GetBlockLastOrdinal(passed + step) < target) {
+            passed += step;
+            step *= 2;
+        }
+        // The first block ending at or after target lies in (passed, passed + step]
+        size_t first = passed + 1;
+        size_t last = std::min(passed + step, block_count);
+        while (first < last) {
+            const size_t middle = (first + last) / 2;
+            if (postings_->GetBlockLastOrdinal(middle) < target) {
+                first = middle + 1;
+            }
+            else {
+                last = middle;
+            }
+        }
+        block = first;
+    }
+    if (block == block_count) {
+        position_ = postings_->size();
+        return;
+    }
+    if (block != position_ / BLOCK_SIZE) {
+        position_ = block * BLOCK_SIZE;
+        LoadBlock();
+    }
+    const uint32_t* const ordinals = GetBlockOrdinals();
+    const size_t block_size = std::min(BLOCK_SIZE, postings_->size() - block * BLOCK_SIZE);
+    position_ = block * BLOCK_SIZE
+                + (std::lower_bound(ordinals + position_ % BLOCK_SIZE, ordinals + block_size, target) - ordinals);
+}
+
+PostingList::Bound PostingList::Cursor::GetBlockBound(uint32_t target) {
+    const size_t block_count = postings_->GetBlockCount();
+    while (shallow_block_ < block_count && postings_->GetBlockLastOrdinal(shallow_block_) < target) {
+        ++shallow_block_;
+    }
+    if (shallow_block_ == block_count || postings_->GetBlockFirstOrdinal(shallow_block_) > target) {
+        return {};
+    }
+    return postings_->GetBlockBound(shallow_block_);
+}
+
+const uint32_t* PostingList::Cursor::GetBlockOrdinals() const {
+    return position_ / BLOCK_SIZE < postings_->blocks_.size()
+           ? decoded_ordinals_.data() : postings_->tail_ordinals_.data();
+}
+
+const uint32_t* PostingList::Cursor::GetBlockTermCounts() const {
+    return position_ / BLOCK_SIZE < postings_->blocks_.size()
+           ? decoded_term_counts_.data() : postings_->tail_term_counts_.data();
+}
+
+void PostingList::Cursor::LoadBlock() {
+    const size_t block = position_ / BLOCK_SIZE;
+    if (block < postings_->blocks_.size()) {
+        postings_->DecodeOrdinals(block, decoded_ordinals_.data());
+        postings_->DecodeTermCounts(block, decoded_term_counts_.data());
+    }
+}
+
+void PostingList::Append(uint32_t ordinal, uint32_t term_count, uint32_t document_length) {
+    const double term_freq = static_cast<double>(term_count) / document_length;
+    if (tail_ordinals_.empty()) {
+        tail_bound_ = {};
+    }
+    tail_bound_.max_term_count = std::max(tail_bound_.max_term_count, term_count);
+    tail_bound_.max_term_freq = std::max(tail_bound_.max_term_freq, term_freq);
+    tail_ordinals_.push_back(ordinal);
+    tail_term_counts_.push_back(term_count);
+    if (tail_ordinals_.size() == BLOCK_SIZE) {
+        SealTail();
+    }
+}
+
+bool PostingList::Contains(uint32_t ordinal) const {
+    const auto it = std::lower_bound(blocks_.begin(), blocks_.end(), ordinal, [](const Block& block, uint32_t ordinal) {
+        return block.last_ordinal < ordinal;
+    });
+    if (it == blocks_.end()) {
+        return std::binary_search(tail_ordinals_.begin(), tail_ordinals_.end(), ordinal);
+    }
+    if (it->first_ordinal > ordinal) {
+        return false;
+    }
+    std::array<uint32_t, BLOCK_SIZE> ordinals;
+    DecodeOrdinals(it - blocks_.begin(), ordinals.data());
+    return std::binary_search(ordinals.begin(), ordinals.end(), ordinal);
+}
+
+PostingList::Bound PostingList::GetBound() const {
+    Bound bound = tail_ordinals_.empty() ? Bound{} : tail_bound_;
+    for (const Block& block : blocks_) {
+        bound.max_term_count = std::max(bound.max_term_count, block.bound.max_term_count);
+        bound.max_term_freq = std::max(bound.max_term_freq, block.bound.max_term_freq);
+    }
+    return bound;
+}
+
+size_t PostingList::size() const {
+    return blocks_.size() * BLOCK_SIZE + tail_ordinals_.size();
+}
+
+bool PostingList::empty() const {
+    return blocks_.empty() && tail_ordinals_.empty();
+}
+
+size_t PostingList::GetBlockCount() const {
+    return blocks_.size() + (tail_ordinals_.empty() ? 0 : 1);
+}
+
+size_t PostingList::CopyBlockOrdinals(size_t block, uint32_t* ordinals) const {
+    if (block < blocks_.size()) {
+        DecodeOrdinals(block, ordinals);
+        return BLOCK_SIZE;
+    }
+    std::copy(tail_ordinals_.begin(), tail_ordinals_.end(), ordinals);
+    return tail_ordinals_.size();
+}
+
+uint32_t PostingList::GetBlockFirstOrdinal(size_t block) const {
+    return block < blocks_.size() ? blocks_[block].first_ordinal : tail_ordinals_.front();
+}
+
+uint32_t PostingList::GetBlockLastOrdinal(size_t block) const {
+    return block < blocks_.size() ? blocks_[block].last_ordinal : tail_ordinals_.back();
+}
+
+PostingList::Bound PostingList::GetBlockBound(size_t block) const {
+    return block < blocks_.size() ? blocks_[block].bound : tail_bound_;
+}
+
+void PostingList::SealTail() {
+    // Gaps and counts are stored minus one, since the ordinals of a list are
+    // distinct and every posting has at least one occurrence
+    std::array<uint32_t, BLOCK_SIZE> gaps{};
+    uint32_t max_gap = 0;
+    for (size_t i = 1; i < BLOCK_SIZE; ++i) {
+        gaps[i] = tail_ordinals_[i] - tail_ordinals_[i - 1] - 1;
+        max_gap |= gaps[i];
+    }
+    std::array<uint32_t, BLOCK_SIZE> term_counts;
+    uint32_t max_term_count = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+        term_counts[i] = tail_term_counts_[i] - 1;
+        max_term_count |= term_counts[i];
+    }
+    const auto ordinal_bit_width = static_cast<uint8_t>(std::bit_width(max_gap));
+    const auto term_count_bit_width = static_cast<uint8_t>(std::bit_width(max_term_count));
+    const size_t offset = packed_.size();
+    blocks_.push_back({tail_ordinals_.front(), tail_ordinals_.back(), static_cast<uint32_t>(offset),
+                       ordinal_bit_width, term_count_bit_width, tail_bound_});
+
+    packed_.resize(offset + BLOCK_SIZE / 32 * (ordinal_bit_width + term_count_bit_width));
+    PackBlock(gaps.data(), ordinal_bit_width, packed_.data() + offset);
+    PackBlock(term_counts.data(), term_count_bit_width, packed_.data() + offset + BLOCK_SIZE / 32 * ordinal_bit_width);
+    tail_ordinals_.clear();
+    tail_term_counts_.clear();
+}
+
+void PostingList::DecodeOrdinals(size_t block, uint32_t* ordinals) const {
+    const Block& meta = blocks_[block];
+    // Unpacking all gaps before the prefix sum keeps the unpacking loop free
+    // of dependencies between iterations
+    UnpackBlock(packed_.data() + meta.offset, meta.ordinal_bit_width, ordinals);
+    ordinals[0] = meta.first_ordinal;
+    for (size_t i = 1; i < BLOCK_SIZE; ++i) {
+        ordinals[i] += ordinals[i - 1] + 1;
+    }
+}
+
+void PostingList::DecodeTermCounts(size_t block, uint32_t* term_counts) const {
+    const Block& meta = blocks_[block];
+    UnpackBlock(packed_.data() + meta.offset + BLOCK_SIZE / 32 * meta.ordinal_bit_width,
+                meta.term_count_bit_width, term_counts);
+    for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+        ++term_counts[i];
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Postings of a term sorted by document ordinal, each holding the number of
+// occurrences of the term in the document. Every BLOCK_SIZE postings form a
+// block; full blocks store their ordinal gaps and term counts bit-packed with
+// the smallest widths that fit, while the last, partial block stays plain so
+// that appending is cheap. Per block the first and last ordinals and the
+// maxima of the term count and of the term frequency (count over document
+// length) are kept apart from the packed data, so a cursor can skip blocks and
+// bound a term's contribution without decoding them.
+class PostingList {
+public:
+    inline static constexpr size_t BLOCK_SIZE = 128;
+    inline static constexpr uint32_t END_ORDINAL = UINT32_MAX;
+
+    // Both maxima are taken separately over a range of postings
+    struct Bound {
+        uint32_t max_term_count = 0;
+        double max_term_freq = 0.0;
+    };
+
+    class Cursor {
+    public:
+        explicit Cursor(const PostingList& postings);
+
+        // END_ORDINAL once the list is exhausted
+        uint32_t GetOrdinal() const;
+        uint32_t GetTermCount() const;
+
+        void Next();
+
+        // Moves to the first posting with ordinal not less than target
+        void SkipTo(uint32_t target);
+
+        // Bound of the block that would hold target, without moving the cursor;
+        // empty if no block can hold it. Targets must not decrease between calls.
+        Bound GetBlockBound(uint32_t target);
+
+    private:
+        const PostingList* postings_;
+        size_t position_ = 0;
+        size_t shallow_block_ = 0;
+        // The full block holding position_, decoded when it is entered
+        std::array<uint32_t, BLOCK_SIZE> decoded_ordinals_;
+        std::array<uint32_t, BLOCK_SIZE> decoded_term_counts_;
+
+        const uint32_t* GetBlockOrdinals() const;
+        const uint32_t* GetBlockTermCounts() const;
+        void LoadBlock();
+    };
+
+    void Append(uint32_t ordinal, uint32_t term_count, uint32_t document_length);
+
+    bool Contains(uint32_t ordinal) const;
+
+    Bound GetBound() const;
+
+    size_t size() const;
+
+    bool empty() const;
+
+    // Postings of block b start at position b * BLOCK_SIZE
+    size_t GetBlockCount() const;
+
+    // Writes the ordinals of the block and returns their number
+    size_t CopyBlockOrdinals(size_t block, uint32_t* ordinals) const;
+
+private:
+    struct Block {
+        uint32_t first_ordinal;
+        uint32_t last_ordinal;
+        // Offset of the packed gaps in packed_, followed by the packed counts
+        uint32_t offset;
+        uint8_t ordinal_bit_width;
+        uint8_t term_count_bit_width;
+        Bound bound;
+    };
+
+    std::vector<Block> blocks_;
+    std::vector<uint32_t> packed_;
+    std::vector<uint32_t> tail_ordinals_;
+    std::vector<uint32_t> tail_term_counts_;
+    Bound tail_bound_;
+
+    uint32_t GetBlockFirstOrdinal(size_t block) const;
+    uint32_t GetBlockLastOrdinal(size_t block) const;
+    Bound GetBlockBound(size_t block) const;
+
+    void SealTail();
+    void DecodeOrdinals(size_t block, uint32_t* ordinals) const;
+    void DecodeTermCounts(size_t block, uint32_t* term_counts) const;
+};
@@ -0,0 +1,428 @@
+#include "roaring_bitmap.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+    // Sets bits [begin, end) of words
+    void SetBitRange(uint64_t* words, size_t begin, size_t end) {
+        while (begin < end) {
+            const size_t word_end = std::min(end, (begin / 64 + 1) * 64);
+            const size_t width = word_end - begin;
+            const uint64_t mask = width == 64 ? UINT64_MAX : ((uint64_t{1} << width) - 1) << (begin % 64);
+            words[begin / 64] |= mask;
+            begin = word_end;
+        }
+    }
+
+    // Pairs of run start and length minus one for sorted distinct values
+    template <typename Iterator>
+    std::vector<uint16_t> MakeRuns(Iterator first, Iterator last) {
+        std::vector<uint16_t> runs;
+        for (; first != last; ++first) {
+            const uint16_t low = *first;
+            if (!runs.empty() && static_cast<uint32_t>(runs[runs.size() - 2]) + runs.back() + 1 == low) {
+                ++runs.back();
+            }
+            else {
+                runs.push_back(low);
+                runs.push_back(0);
+            }
+        }
+        return runs;
+    }
+}
+
+void RoaringBitmap::Add(uint32_t value) {
+    const auto key = static_cast<uint16_t>(value >> 16);
+    Container* container = FindContainer(key);
+    if (container == nullptr) {
+        const auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                                         [](const Container& container, uint16_t key) {
+                                             return container.key < key;
+                                         });
+        container = &*containers_.insert(it, MakeEmptyContainer(key));
+    }
+    AddToContainer(*container, static_cast<uint16_t>(value));
+}
+
+bool RoaringBitmap::Contains(uint32_t value) const {
+    const Container* container = FindContainer(static_cast<uint16_t>(value >> 16));
+    return container != nullptr && Contains(*container, static_cast<uint16_t>(value));
+}
+
+size_t RoaringBitmap::size() const {
+    size_t size = 0;
+    for (const Container& container : containers_) {
+        size += container.cardinality;
+    }
+    return size;
+}
+
+bool RoaringBitmap::empty() const {
+    return containers_.empty();
+}
+
+void RoaringBitmap::Optimize() {
+    for (Container& container : containers_) {
+        OptimizeContainer(container);
+    }
+}
+
+RoaringBitmap RoaringBitmap::And(const RoaringBitmap& lhs, const RoaringBitmap& rhs) {
+    RoaringBitmap result;
+    auto lhs_it = lhs.containers_.begin();
+    auto rhs_it = rhs.containers_.begin();
+    while (lhs_it != lhs.containers_.end() && rhs_it != rhs.containers_.end()) {
+        if (lhs_it->key < rhs_it->key) {
+            ++lhs_it;
+        }
+        else if (rhs_it->key < lhs_it->key) {
+            ++rhs_it;
+        }
+        else {
+            Container container = AndContainers(*lhs_it++, *rhs_it++);
+            if (container.cardinality != 0) {
+                result.containers_.push_back(std::move(container));
+            }
+        }
+    }
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::Or(const RoaringBitmap& lhs, const RoaringBitmap& rhs) {
+    RoaringBitmap result;
+    auto lhs_it = lhs.containers_.begin();
+    auto rhs_it = rhs.containers_.begin();
+    while (lhs_it != lhs.containers_.end() || rhs_it != rhs.containers_.end()) {
+        if (rhs_it == rhs.containers_.end() || (lhs_it != lhs.containers_.end() && lhs_it->key < rhs_it->key)) {
+            result.containers_.push_back(*lhs_it++);
+        }
+        else if (lhs_it == lhs.containers_.end() || rhs_it->key < lhs_it->key) {
+            result.containers_.push_back(*rhs_it++);
+        }
+        else {
+            result.containers_.push_back(OrContainers(*lhs_it++, *rhs_it++));
+        }
+    }
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::AndNot(const RoaringBitmap& lhs, const RoaringBitmap& rhs) {
+    RoaringBitmap result;
+    for (const Container& container : lhs.containers_) {
+        const Container* other = rhs.FindContainer(container.key);
+        if (other == nullptr) {
+            result.containers_.push_back(container);
+            continue;
+        }
+        Container difference = AndNotContainers(container, *other);
+        if (difference.cardinality != 0) {
+            result.containers_.push_back(std::move(difference));
+        }
+    }
+    return result;
+}
+
+void RoaringBitmap::OrInto(uint32_t first, size_t count, uint64_t* words) const {
+    const uint64_t last = uint64_t{first} + count;
+    for (const Container& container : containers_) {
+        const uint64_t high = uint64_t{container.key} << 16;
+        if (high + 65536 <= first || high >= last) {
+            continue;
+        }
+        switch (container.kind) {
+            case Kind::ARRAY: {
+                auto it = container.values.begin();
+                if (high < first) {
+                    it = std::lower_bound(it, container.values.end(), static_cast<uint16_t>(first - high));
+                }
+                for (; it != container.values.end() && high + *it < last; ++it) {
+                    const uint64_t bit = high + *it - first;
+                    words[bit / 64] |= uint64_t{1} << (bit % 64);
+                }
+                break;
+            }
+            case Kind::BITSET:
+                // Bits outside the range are cleared before the word is shifted into place
+                for (size_t word = 0; word < BITSET_WORDS; ++word) {
+                    const uint64_t base = high + word * 64;
+                    if (base + 64 <= first || base >= last) {
+                        continue;
+                    }
+                    uint64_t bits = container.words[word];
+                    if (base < first) {
+                        bits &= UINT64_MAX << (first - base);
+                    }
+                    if (base + 64 > last) {
+                        bits &= (uint64_t{1} << (last - base)) - 1;
+                    }
+                    if (base < first) {
+                        words[0] |= bits >> (first - base);
+                        continue;
+                    }
+                    const uint64_t offset = base - first;
+                    words[offset / 64] |= bits << (offset % 64);
+                    if (offset % 64 != 0 && (bits >> (64 - offset % 64)) != 0) {
+                        words[offset / 64 + 1] |= bits >> (64 - offset % 64);
+                    }
+                }
+                break;
+            case Kind::RUN:
+                for (size_t i = 0; i < container.values.size(); i += 2) {
+                    const uint64_t begin = std::max<uint64_t>(high + container.values[i], first);
+                    const uint64_t end = std::min<uint64_t>(high + container.values[i] + container.values[i + 1] + 1, last);
+                    if (begin < end) {
+                        SetBitRange(words, begin - first, end - first);
+                    }
+                }
+                break;
+        }
+    }
+}
+
+RoaringBitmap::Container* RoaringBitmap::FindContainer(uint16_t key) {
+    return const_cast<Container*>(static_cast<const RoaringBitmap*>(this)->FindContainer(key));
+}
+
+const RoaringBitmap::Container* RoaringBitmap::FindContainer(uint16_t key) const {
+    // Values mostly arrive in increasing order, so the last container is tried first
+    if (!containers_.empty() && containers_.back().key == key) {
+        return &containers_.back();
+    }
+    const auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                                     [](const Container& container, uint16_t key) {
+                                         return container.key < key;
+                                     });
+    return it != containers_.end() && it->key == key ? &*it : nullptr;
+}
+
+bool RoaringBitmap::Contains(const Container& container, uint16_t low) {
+    switch (container.kind) {
+        case Kind::ARRAY:
+            return std::binary_search(container.values.begin(), container.values.end(), low);
+        case Kind::BITSET:
+            return (container.words[low / 64] >> (low % 64)) & 1;
+        case Kind::RUN: {
+            // Last run starting at or before low
+            size_t first = 0;
+            size_t last = container.values.size() / 2;
+            while (first < last) {
+                const size_t middle = (first + last) / 2;
+                if (container.values[middle * 2] <= low) {
+                    first = middle + 1;
+                }
+                else {
+                    last = middle;
+                }
+            }
+            return first != 0 && low - container.values[(first - 1) * 2] <= container.values[(first - 1) * 2 + 1];
+        }
+    }
+    return false;
+}
+
+void RoaringBitmap::ToBitset(const Container& container, uint64_t* words) {
+    std::fill(words, words + BITSET_WORDS, 0);
+    switch (container.kind) {
+        case Kind::ARRAY:
+            for (const uint16_t low : container.values) {
+                words[low / 64] |= uint64_t{1} << (low % 64);
+            }
+            break;
+        case Kind::BITSET:
+            std::copy(container.words.begin(), container.words.end(), words);
+            break;
+        case Kind::RUN:
+            for (size_t i = 0; i < container.values.size(); i += 2) {
+                SetBitRange(words, container.values[i], container.values[i] + container.values[i + 1] + 1);
+            }
+            break;
+    }
+}
+
+RoaringBitmap::Container RoaringBitmap::MakeEmptyContainer(uint16_t key) {
+    Container container;
+    container.key = key;
+    return container;
+}
+
+RoaringBitmap::Container RoaringBitmap::MakeBitsetContainer(uint16_t key, std::vector<uint64_t> words) {
+    Container container = MakeEmptyContainer(key);
+    for (const uint64_t word : words) {
+        container.cardinality += std::popcount(word);
+    }
+    if (container.cardinality > MAX_ARRAY_SIZE) {
+        container.kind = Kind::BITSET;
+        container.words = std::move(words);
+        return container;
+    }
+    container.values.reserve(container.cardinality);
+    for (size_t word = 0; word < BITSET_WORDS; ++word) {
+        for (uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+            container.values.push_back(static_cast<uint16_t>(word * 64 + std::countr_zero(bits)));
+        }
+    }
+    return container;
+}
+
+void RoaringBitmap::AddToContainer(Container& container, uint16_t low) {
+    switch (container.kind) {
+        case Kind::ARRAY: {
+            auto& values = container.values;
+            if (values.empty() || values.back() < low) {
+                values.push_back(low);
+            }
+            else {
+                const auto it = std::lower_bound(values.begin(), values.end(), low);
+                if (*it == low) {
+                    return;
+                }
+                values.insert(it, low);
+            }
+            if (++container.cardinality > MAX_ARRAY_SIZE) {
+                std::vector<uint64_t> words(BITSET_WORDS);
+                ToBitset(container, words.data());
+                container = MakeBitsetContainer(container.key, std::move(words));
+            }
+            return;
+        }
+        case Kind::BITSET: {
+            uint64_t& word = container.words[low / 64];
+            const uint64_t bit = uint64_t{1} << (low % 64);
+            container.cardinality += (word & bit) == 0;
+            word |= bit;
+            return;
+        }
+        case Kind::RUN: {
+            auto& runs = container.values;
+            const uint32_t end = runs.empty() ? 0 : static_cast<uint32_t>(runs[runs.size() - 2]) + runs.back() + 1;
+            if (runs.empty() || low > end) {
+                runs.push_back(low);
+                runs.push_back(0);
+            }
+            else if (low == end) {
+                ++runs.back();
+            }
+            else if (Contains(container, low)) {
+                return;
+            }
+            else {
+                // Only appending keeps the runs; anything else goes through a bitset
+                std::vector<uint64_t> words(BITSET_WORDS);
+                ToBitset(container, words.data());
+                container = MakeBitsetContainer(container.key, std::move(words));
+                AddToContainer(container, low);
+                return;
+            }
+            ++container.cardinality;
+            return;
+        }
+    }
+}
+
+void RoaringBitmap::OptimizeContainer(Container& container) {
+    if (container.kind == Kind::RUN) {
+        return;
+    }
+    size_t run_count = 0;
+    if (container.kind == Kind::ARRAY) {
+        for (size_t i = 0; i < container.values.size(); ++i) {
+            run_count += i == 0 || container.values[i] != container.values[i - 1] + 1;
+        }
+    }
+    else {
+        // A run starts at every set bit whose predecessor is clear
+        uint64_t carry = 0;
+        for (const uint64_t word : container.words) {
+            run_count += std::popcount(word & ~((word << 1) | carry));
+            carry = word >> 63;
+        }
+    }
+    const size_t size = container.kind == Kind::ARRAY ? container.values.size() * 2 : BITSET_WORDS * 8;
+    if (run_count * 4 >= size) {
+        return;
+    }
+    std::vector<uint16_t> lows;
+    lows.reserve(container.cardinality);
+    if (container.kind == Kind::ARRAY) {
+        lows = std::move(container.values);
+    }
+    else {
+        for (size_t word = 0; word < BITSET_WORDS; ++word) {
+            for (uint64_t bits = container.words[word]; bits != 0; bits &= bits - 1) {
+                lows.push_back(static_cast<uint16_t>(word * 64 + std::countr_zero(bits)));
+            }
+        }
+    }
+    container.values = MakeRuns(lows.begin(), lows.end());
+    container.values.shrink_to_fit();
+    container.words = {};
+    container.kind = Kind::RUN;
+}
+
+RoaringBitmap::Container RoaringBitmap::AndContainers(const Container& lhs, const Container& rhs) {
+    if (lhs.kind == Kind::ARRAY || rhs.kind == Kind::ARRAY) {
+        // The array side is filtered by membership in the other side
+        const Container& array = lhs.kind == Kind::ARRAY ? lhs : rhs;
+        const Container& other = lhs.kind == Kind::ARRAY ? rhs : lhs;
+        Container container = MakeEmptyContainer(lhs.key);
+        if (other.kind == Kind::ARRAY) {
+            std::set_intersection(array.values.begin(), array.values.end(), other.values.begin(), other.values.end(),
+                                  std::back_inserter(container.values));
+        }
+        else {
+            std::copy_if(array.values.begin(), array.values.end(), std::back_inserter(container.values),
+                         [&other](uint16_t low) {
+                             return Contains(other, low);
+                         });
+        }
+        container.cardinality = static_cast<uint32_t>(container.values.size());
+        return container;
+    }
+    std::vector<uint64_t> words(BITSET_WORDS);
+    std::vector<uint64_t> rhs_words(BITSET_WORDS);
+    ToBitset(lhs, words.data());
+    ToBitset(rhs, rhs_words.data());
+    for (size_t word = 0; word < BITSET_WORDS; ++word) {
+        words[word] &= rhs_words[word];
+    }
+    return MakeBitsetContainer(lhs.key, std::move(words));
+}
+
+RoaringBitmap::Container RoaringBitmap::OrContainers(const Container& lhs, const Container& rhs) {
+    if (lhs.kind == Kind::ARRAY && rhs.kind == Kind::ARRAY && lhs.cardinality + rhs.cardinality <= MAX_ARRAY_SIZE) {
+        Container container = MakeEmptyContainer(lhs.key);
+        std::set_union(lhs.values.begin(), lhs.values.end(), rhs.values.begin(), rhs.values.end(),
+                       std::back_inserter(container.values));
+        container.cardinality = static_cast<uint32_t>(container.values.size());
+        return container;
+    }
+    std::vector<uint64_t> words(BITSET_WORDS);
+    std::vector<uint64_t> rhs_words(BITSET_WORDS);
+    ToBitset(lhs, words.data());
+    ToBitset(rhs, rhs_words.data());
+    for (size_t word = 0; word < BITSET_WORDS; ++word) {
+        words[word] |= rhs_words[word];
+    }
+    return MakeBitsetContainer(lhs.key, std::move(words));
+}
+
+RoaringBitmap::Container RoaringBitmap::AndNotContainers(const Container& lhs, const Container& rhs) {
+    if (lhs.kind == Kind::ARRAY) {
+        Container container = MakeEmptyContainer(lhs.key);
+        std::copy_if(lhs.values.begin(), lhs.values.end(), std::back_inserter(container.values),
+                     [&rhs](uint16_t low) {
+                         return !Contains(rhs, low);
+                     });
+        container.cardinality = static_cast<uint32_t>(container.values.size());
+        return container;
+    }
+    std::vector<uint64_t> words(BITSET_WORDS);
+    std::vector<uint64_t> rhs_words(BITSET_WORDS);
+    ToBitset(lhs, words.data());
+    ToBitset(rhs, rhs_words.data());
+    for (size_t word = 0; word < BITSET_WORDS; ++word) {
+        words[word] &= ~rhs_words[word];
+    }
+    return MakeBitsetContainer(lhs.key, std::move(words));
+}
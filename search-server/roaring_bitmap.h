@@ -0,0 +1,106 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compressed set of 32-bit values in the Roaring layout: values are grouped
+// by their upper 16 bits, and each group is stored in whichever container is
+// smallest for it - a sorted array of the lower halves while sparse, a 65536
+// bit bitset while dense, or a list of runs for long stretches of consecutive
+// values. Intersections, unions and differences work container by container,
+// with word-parallel loops wherever a bitset is involved.
+class RoaringBitmap {
+public:
+    // Values are cheapest to add in increasing order
+    void Add(uint32_t value);
+
+    bool Contains(uint32_t value) const;
+
+    size_t size() const;
+
+    bool empty() const;
+
+    // Turns containers into runs where that takes less memory
+    void Optimize();
+
+    static RoaringBitmap And(const RoaringBitmap& lhs, const RoaringBitmap& rhs);
+
+    static RoaringBitmap Or(const RoaringBitmap& lhs, const RoaringBitmap& rhs);
+
+    static RoaringBitmap AndNot(const RoaringBitmap& lhs, const RoaringBitmap& rhs);
+
+    // Sets bit value - first of words for every value in [first, first + count)
+    void OrInto(uint32_t first, size_t count, uint64_t* words) const;
+
+    // Calls function(value) for every value in increasing order
+    template <typename Function>
+    void ForEach(Function function) const;
+
+private:
+    enum class Kind : uint8_t {
+        ARRAY,
+        BITSET,
+        RUN,
+    };
+
+    struct Container {
+        uint16_t key = 0;
+        Kind kind = Kind::ARRAY;
+        uint32_t cardinality = 0;
+        // ARRAY: sorted lower halves; RUN: pairs of run start and length minus one
+        std::vector<uint16_t> values;
+        // BITSET: BITSET_WORDS words
+        std::vector<uint64_t> words;
+    };
+
+    inline static constexpr size_t BITSET_WORDS = 65536 / 64;
+    // Beyond this many values a bitset is smaller than an array
+    inline static constexpr uint32_t MAX_ARRAY_SIZE = 4096;
+
+    std::vector<Container> containers_;
+
+    Container* FindContainer(uint16_t key);
+    const Container* FindContainer(uint16_t key) const;
+
+    static bool Contains(const Container& container, uint16_t low);
+    static void ToBitset(const Container& container, uint64_t* words);
+    // An ARRAY container without values
+    static Container MakeEmptyContainer(uint16_t key);
+    static Container MakeBitsetContainer(uint16_t key, std::vector<uint64_t> words);
+    static void AddToContainer(Container& container, uint16_t low);
+    static void OptimizeContainer(Container& container);
+
+    static Container AndContainers(const Container& lhs, const Container& rhs);
+    static Container OrContainers(const Container& lhs, const Container& rhs);
+    static Container AndNotContainers(const Container& lhs, const Container& rhs);
+};
+
+template <typename Function>
+void RoaringBitmap::ForEach(Function function) const {
+    for (const Container& container : containers_) {
+        const uint32_t high = static_cast<uint32_t>(container.key) << 16;
+        switch (container.kind) {
+            case Kind::ARRAY:
+                for (const uint16_t low : container.values) {
+                    function(high | low);
+                }
+                break;
+            case Kind::BITSET:
+                for (size_t word = 0; word < BITSET_WORDS; ++word) {
+                    for (uint64_t bits = container.words[word]; bits != 0; bits &= bits - 1) {
+                        function(high | static_cast<uint32_t>(word * 64 + std::countr_zero(bits)));
+                    }
+                }
+                break;
+            case Kind::RUN:
+                for (size_t i = 0; i < container.values.size(); i += 2) {
+                    const uint32_t start = container.values[i];
+                    for (uint32_t low = start; low <= start + container.values[i + 1]; ++low) {
+                        function(high | low);
+                    }
+                }
+                break;
+        }
+    }
+}
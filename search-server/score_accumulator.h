@@ -0,0 +1,147 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Dense relevance accumulator indexed by document ordinal. Slots are stamped
+// with the generation of the query that wrote them, so a new query does not
+// clear the arrays, and the touched list lets results be collected without
+// scanning every ordinal. Ordinals excluded by minus words are kept in a
+// bitmap that the scoring loop checks before accumulating. A second bitmap
+// holds the ordinals the query predicate accepted, so that it runs at most
+// once per document; rejected ones join the excluded. Quantized queries
+// use plain integer scores instead, kept at zero between queries so that the
+// accumulation loop stays free of branches; the 64-ordinal blocks a query
+// wrote are listed, and only those are collected and zeroed again.
+class ScoreAccumulator {
+public:
+    // One accumulator per thread, reused by every query run on it
+    static ScoreAccumulator& ForCurrentThread() {
+        thread_local ScoreAccumulator accumulator;
+        return accumulator;
+    }
+
+    void Reset(size_t ordinal_count) {
+        if (scores_.size() < ordinal_count) {
+            scores_.resize(ordinal_count);
+            stamps_.resize(ordinal_count);
+            excluded_.resize((ordinal_count + 63) / 64);
+            accepted_.resize((ordinal_count + 63) / 64);
+        }
+        touched_.clear();
+        for (const uint32_t word : dirty_excluded_words_) {
+            excluded_[word] = 0;
+        }
+        dirty_excluded_words_.clear();
+        std::fill(excluded_.begin(), excluded_.begin() + excluded_word_count_, 0);
+        excluded_word_count_ = 0;
+        for (const uint32_t word : dirty_accepted_words_) {
+            accepted_[word] = 0;
+        }
+        dirty_accepted_words_.clear();
+        if (++generation_ == 0) {
+            std::fill(stamps_.begin(), stamps_.end(), 0);
+            generation_ = 1;
+        }
+    }
+
+    void Add(uint32_t ordinal, double score) {
+        if (stamps_[ordinal] != generation_) {
+            stamps_[ordinal] = generation_;
+            scores_[ordinal] = 0.0;
+            touched_.push_back(ordinal);
+        }
+        scores_[ordinal] += score;
+    }
+
+    void Exclude(uint32_t ordinal) {
+        uint64_t& word = excluded_[ordinal / 64];
+        if (word == 0 && ordinal / 64 >= excluded_word_count_) {
+            dirty_excluded_words_.push_back(ordinal / 64);
+        }
+        word |= uint64_t{1} << (ordinal % 64);
+    }
+
+    bool IsExcluded(uint32_t ordinal) const {
+        return (excluded_[ordinal / 64] >> (ordinal % 64)) & 1;
+    }
+
+    // For excluding whole bitmaps: the caller ORs one bit per ordinal into the
+    // returned words
+    uint64_t* GetExcludedWords(size_t ordinal_count) {
+        excluded_word_count_ = std::max(excluded_word_count_, (ordinal_count + 63) / 64);
+        return excluded_.data();
+    }
+
+    void Accept(uint32_t ordinal) {
+        uint64_t& word = accepted_[ordinal / 64];
+        if (word == 0) {
+            dirty_accepted_words_.push_back(ordinal / 64);
+        }
+        word |= uint64_t{1} << (ordinal % 64);
+    }
+
+    bool IsAccepted(uint32_t ordinal) const {
+        return (accepted_[ordinal / 64] >> (ordinal % 64)) & 1;
+    }
+
+    uint32_t* ResetQuantizedScores(size_t ordinal_count) {
+        for (const uint32_t block : quantized_blocks_) {
+            std::fill_n(quantized_scores_.begin() + block * 64, 64, 0);
+            quantized_block_bits_[block / 64] = 0;
+        }
+        quantized_blocks_.clear();
+        const size_t block_count = (ordinal_count + 63) / 64;
+        if (quantized_scores_.size() < block_count * 64) {
+            quantized_scores_.resize(block_count * 64);
+            quantized_block_bits_.resize((block_count + 63) / 64);
+        }
+        return quantized_scores_.data();
+    }
+
+    // Records the blocks of sorted ordinals about to be accumulated
+    void MarkQuantizedBlocks(const uint32_t* ordinals, size_t count) {
+        uint32_t last_block = UINT32_MAX;
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t block = ordinals[i] / 64;
+            if (block == last_block) {
+                continue;
+            }
+            last_block = block;
+            uint64_t& bits = quantized_block_bits_[block / 64];
+            if (!((bits >> (block % 64)) & 1)) {
+                bits |= uint64_t{1} << (block % 64);
+                quantized_blocks_.push_back(block);
+            }
+        }
+    }
+
+    // Blocks written since ResetQuantizedScores, in ascending order
+    const std::vector<uint32_t>& GetQuantizedBlocks() {
+        std::sort(quantized_blocks_.begin(), quantized_blocks_.end());
+        return quantized_blocks_;
+    }
+
+    double GetScore(uint32_t ordinal) const {
+        return scores_[ordinal];
+    }
+
+    const std::vector<uint32_t>& GetTouched() const {
+        return touched_;
+    }
+
+private:
+    std::vector<double> scores_;
+    std::vector<uint32_t> stamps_;
+    std::vector<uint32_t> touched_;
+    uint32_t generation_ = 0;
+    std::vector<uint64_t> excluded_;
+    std::vector<uint32_t> dirty_excluded_words_;
+    // Leading words written through GetExcludedWords
+    size_t excluded_word_count_ = 0;
+    std::vector<uint64_t> accepted_;
+    std::vector<uint32_t> dirty_accepted_words_;
+    std::vector<uint32_t> quantized_scores_;
+    std::vector<uint32_t> quantized_blocks_;
+    std::vector<uint64_t> quantized_block_bits_;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "posting_list.h"
+
+// Relevance functions for SearchServer queries, chosen by template argument
+// so that the per-posting score is inlined into the query loops. A scorer is
+// built once per query from the collection statistics and provides:
+// - ComputeTermWeight: the weight of a query term given its document frequency;
+// - ComputeScore: the contribution of one posting of a term with that weight;
+// - ComputeMaxScore: an upper bound of ComputeScore over postings within a bound.
+
+// Term frequency (count over document length) times inverse document frequency
+struct TfIdf {
+    inline static constexpr uint32_t MAX_IMPACT = UINT16_MAX;
+
+    explicit TfIdf(double /*average_document_length*/) {
+    }
+
+    // Term frequency quantized to 16 bits, kept nonzero for every posting
+    static uint16_t ComputeImpact(uint32_t term_count, uint32_t document_length) {
+        const double impact = std::round(static_cast<double>(term_count) / document_length * MAX_IMPACT);
+        return static_cast<uint16_t>(std::max(impact, 1.0));
+    }
+
+    static double ComputeTermWeight(double document_count, double document_freq) {
+        // Frozen statistics may count fewer documents than the term occurs in
+        return std::log(std::max(document_count, document_freq) / document_freq);
+    }
+
+    double ComputeScore(uint32_t term_count, uint32_t document_length, double term_weight) const {
+        return static_cast<double>(term_count) / document_length * term_weight;
+    }
+
+    double ComputeMaxScore(const PostingList::Bound& bound, double term_weight) const {
+        return bound.max_term_freq * term_weight;
+    }
+};
+
+// Okapi BM25
+struct Bm25 {
+    inline static constexpr double K1 = 1.2;
+    inline static constexpr double B = 0.75;
+
+    // The length normalization K1 * (1 - B + B * length / average_length)
+    // becomes one multiply-add per posting
+    explicit Bm25(double average_document_length)
+            : norm_base_(K1 * (1.0 - B)),
+              norm_per_length_(average_document_length > 0.0 ? K1 * B / average_document_length : 0.0) {
+    }
+
+    static double ComputeTermWeight(double document_count, double document_freq) {
+        return std::log(1.0 + (std::max(document_count, document_freq) - document_freq + 0.5) / (document_freq + 0.5));
+    }
+
+    double ComputeScore(uint32_t term_count, uint32_t document_length, double term_weight) const {
+        return term_weight * term_count * (K1 + 1.0) / (term_count + norm_base_ + norm_per_length_ * document_length);
+    }
+
+    // Dividing the score by the count shows it grows with the count and with
+    // count / length, so both maxima together bound it
+    double ComputeMaxScore(const PostingList::Bound& bound, double term_weight) const {
+        if (bound.max_term_count == 0) {
+            return 0.0;
+        }
+        return term_weight * (K1 + 1.0)
+               / (1.0 + norm_base_ / bound.max_term_count + norm_per_length_ / bound.max_term_freq);
+    }
+
+private:
+    double norm_base_;
+    double norm_per_length_;
+};
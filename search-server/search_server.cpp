@@ -1,5 +1,26 @@
 #include "search_server.h"
 
+namespace {
+    void AppendVarint(uint32_t value, vector<uint8_t>& bytes) {
+        while (value >= 0x80) {
+            bytes.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(value));
+    }
+
+    uint32_t ReadVarint(const uint8_t*& data) {
+        uint32_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            const uint8_t byte = *data++;
+            value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+    }
+}
+
 SearchServer::SearchServer(const string& stop_words_text)
         : SearchServer(
         SplitIntoWords(stop_words_text))  // Invoke delegating constructor from string container
@@ -10,30 +31,74 @@ SearchServer::SearchServer(std::string_view stop_text) : SearchServer(SplitIntoW
 
 void SearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status,
                                const vector<int>& ratings) {
-    if (documents_.count(document_id) != 0 or document_id < 0) {
+    if (document_ordinals_.count(document_id) != 0 or document_id < 0) {
         throw invalid_argument("Denied document_id");
     }
-    indexes.push_back(document_id);
-    storage.emplace_back(document);
-    const vector<string_view> words = SplitIntoWordsNoStop(storage.back());
+    if (static_cast<size_t>(status) >= STATUS_COUNT) {
+        throw invalid_argument("Denied document status");
+    }
+    const vector<string_view> words = SplitIntoWordsNoStop(document);
     for (const auto& str : words) {
         if (!IsValidWord(str)) {
             throw invalid_argument("Denied characters in input sentence");
         }
     }
-    const double inv_word_count = 1.0 / words.size();
+    const auto ordinal = static_cast<uint32_t>(document_ids_.size());
+    document_ordinals_.emplace(document_id, ordinal);
+    document_ids_.push_back(document_id);
+    const auto length = static_cast<uint32_t>(words.size());
+    document_ratings_.push_back(ComputeAverageRating(ratings));
+    document_statuses_.push_back(status);
+    document_lengths_.push_back(length);
+    total_length_ += length;
+    tombstones_.push_back(false);
+
+    vector<TermId> term_ids;
+    term_ids.reserve(words.size());
     for (const auto& word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word] += inv_word_count;
+        term_ids.push_back(term_dictionary_.Insert(word));
     }
-    documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
+    // In document order, for the positional index
+    const vector<TermId> word_term_ids = are_positions_enabled_ ? term_ids : vector<TermId>();
+    postings_.resize(term_dictionary_.size());
+    term_statistics_.resize(term_dictionary_.size());
+    if (are_impacts_enabled_) {
+        impacts_.resize(term_dictionary_.size());
+    }
+    if (are_impact_orders_enabled_) {
+        impact_orders_.resize(term_dictionary_.size());
+    }
+    term_bitmaps_.resize(term_dictionary_.size());
+    sort(term_ids.begin(), term_ids.end());
+
+    auto& document_terms = document_terms_.emplace_back();
+    for (auto first = term_ids.begin(); first != term_ids.end(); ) {
+        const auto last = upper_bound(first, term_ids.end(), *first);
+        const auto term_count = static_cast<uint32_t>(last - first);
+        document_terms.term_ids.push_back(*first);
+        document_terms.term_counts.push_back(term_count);
+
+        // Ordinals only grow, so appending keeps every posting list sorted
+        postings_[*first][static_cast<size_t>(status)].Append(ordinal, term_count, length);
+        if (are_impacts_enabled_) {
+            impacts_[*first][static_cast<size_t>(status)].push_back(TfIdf::ComputeImpact(term_count, length));
+        }
+        ++term_statistics_[*first].document_freq;
+        UpdateImpactOrder(*first, ordinal, TfIdf::ComputeImpact(term_count, length));
+        UpdateTermBitmap(*first, ordinal);
+        first = last;
+    }
+    if (are_positions_enabled_) {
+        EncodePositions(document, word_term_ids, document_terms);
+    }
+    OnCollectionChanged();
 }
 
 int SearchServer::GetDocumentId(int index) {
-    if (count(indexes.begin(), indexes.end(), index) == 0) {
+    if (index < 0 || index >= GetDocumentCount()) {
         throw out_of_range("Such index is out of range");
     }
-    return indexes.at(index);
+    return *next(begin(), index);
 }
 
 vector<Document> SearchServer::FindTopDocuments(string_view raw_query) const {
@@ -42,7 +107,7 @@ vector<Document> SearchServer::FindTopDocuments(string_view raw_query) const {
 
 
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    return static_cast<int>(document_ordinals_.size());
 }
 
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_view raw_query, int document_id) const {
@@ -50,51 +115,66 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_vi
 }
 
 tuple<vector<string_view>, DocumentStatus>
-SearchServer::MatchDocument(const execution::sequenced_policy &seqOrParRem, const string_view raw_query,
+SearchServer::MatchDocument(const execution::sequenced_policy&, const string_view raw_query,
                             int document_id) const {
+    if (const optional<BooleanQueryNode> boolean_query = ParseBooleanQuery(raw_query)) {
+        const uint32_t ordinal = GetDocumentOrdinal(document_id);
+        return {GetSortedWords(MatchBooleanQuery(*boolean_query, ordinal)), document_statuses_[ordinal]};
+    }
     const Query query = ParseQuery(true, raw_query);
-    vector<string_view> matched_words;
-    for (const auto& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id) != 0) {
-            return tuple<vector<string_view>, DocumentStatus>({matched_words, documents_.at(document_id).status});
+    const uint32_t ordinal = GetDocumentOrdinal(document_id);
+    const DocumentStatus status = document_statuses_[ordinal];
+    vector<TermId> matched_terms;
+    if (query.has_absent_required_word) {
+        return tuple<vector<string_view>, DocumentStatus>({vector<string_view>{}, status});
+    }
+    for (const TermId term_id : query.minus_words) {
+        if (HasTerm(ordinal, status, term_id)) {
+            return tuple<vector<string_view>, DocumentStatus>({vector<string_view>{}, status});
         }
     }
-    for (const auto& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+    for (const TermId term_id : query.required_words) {
+        if (!HasTerm(ordinal, status, term_id)) {
+            return tuple<vector<string_view>, DocumentStatus>({vector<string_view>{}, status});
         }
-        if (word_to_document_freqs_.at(word).count(document_id) != 0) {
-            matched_words.push_back(word);
+    }
+    for (const TermId term_id : query.plus_words) {
+        if (HasTerm(ordinal, status, term_id)) {
+            matched_terms.push_back(term_id);
         }
     }
-    return tuple<vector<string_view>, DocumentStatus>({matched_words, documents_.at(document_id).status});
+    return tuple<vector<string_view>, DocumentStatus>({GetSortedWords(matched_terms), status});
 }
 
 tuple<vector<string_view>, DocumentStatus>
 SearchServer::MatchDocument(const execution::parallel_policy &seqOrParRem, string_view raw_query,
                             int document_id) const {
+    if (const optional<BooleanQueryNode> boolean_query = ParseBooleanQuery(raw_query)) {
+        const uint32_t ordinal = GetDocumentOrdinal(document_id);
+        return {GetSortedWords(MatchBooleanQuery(*boolean_query, ordinal)), document_statuses_[ordinal]};
+    }
     Query query = ParseQuery(false, raw_query);
+    const uint32_t ordinal = GetDocumentOrdinal(document_id);
+    const DocumentStatus status = document_statuses_[ordinal];
 
-    vector<string_view> matched_words(query.plus_words.size());
+    vector<TermId> matched_terms(query.plus_words.size());
 
-    if (std::any_of(seqOrParRem, query.minus_words.begin(), query.minus_words.end(), [this, document_id](const auto minus_word) {
-        return word_to_document_freqs_.count(minus_word) != 0 && word_to_document_freqs_.at(minus_word).count(document_id) != 0;
-    })) {
-        return tuple<vector<string_view>, DocumentStatus>({vector<string_view>{}, documents_.at(document_id).status});
+    const auto has_term = [this, ordinal, status](const TermId term_id) {
+        return HasTerm(ordinal, status, term_id);
+    };
+    if (query.has_absent_required_word
+        || std::any_of(seqOrParRem, query.minus_words.begin(), query.minus_words.end(), has_term)
+        || !std::all_of(seqOrParRem, query.required_words.begin(), query.required_words.end(), has_term)) {
+        return tuple<vector<string_view>, DocumentStatus>({vector<string_view>{}, status});
     }
     else {
-        std::copy_if(seqOrParRem, query.plus_words.begin(), query.plus_words.end(), matched_words.begin(), [this, document_id](const auto plus_word){
-            return word_to_document_freqs_.count(plus_word) != 0 && word_to_document_freqs_.at(plus_word).count(document_id) != 0;
-        });
+        matched_terms.erase(std::copy_if(seqOrParRem, query.plus_words.begin(), query.plus_words.end(),
+                                         matched_terms.begin(), has_term),
+                            matched_terms.end());
     }
-    sort(seqOrParRem, matched_words.begin(), matched_words.end(), [](const auto lhs, const auto rhs) {
-        return lhs < rhs;
-    });
-    matched_words.erase(unique(seqOrParRem, matched_words.begin(), matched_words.end()), matched_words.end());
-    return tuple<vector<string_view>, DocumentStatus>({{++matched_words.begin(), matched_words.end()}, documents_.at(document_id).status});
+    sort(seqOrParRem, matched_terms.begin(), matched_terms.end());
+    matched_terms.erase(unique(seqOrParRem, matched_terms.begin(), matched_terms.end()), matched_terms.end());
+    return tuple<vector<string_view>, DocumentStatus>({GetSortedWords(matched_terms), status});
 }
 
 bool SearchServer::IsValidStopWords() const {
@@ -139,18 +219,60 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view text) const {
         throw invalid_argument("Denied characters in text");
     }
     bool is_minus = false;
+    bool is_required = false;
+    bool is_prefix = false;
     // Word shouldn't be empty
     if (text[0] == '-') {
         if (static_cast<int>(text.size()) == 1) {
             throw invalid_argument("there is minus without word");
         }
-        else if (text[1] == '-') {
+        else if (text[1] == '-' || text[1] == '+') {
             throw invalid_argument("there is double minus");
         }
         is_minus = true;
         text = text.substr(1);
     }
-    return {text, is_minus, IsStopWord(text)};
+    else if (text[0] == '+') {
+        if (static_cast<int>(text.size()) == 1) {
+            throw invalid_argument("there is plus without word");
+        }
+        else if (text[1] == '+' || text[1] == '-') {
+            throw invalid_argument("there is double plus");
+        }
+        is_required = true;
+        text = text.substr(1);
+    }
+    if (!text.empty() && text.back() == '*') {
+        if (text.size() == 1) {
+            throw invalid_argument("there is asterisk without word");
+        }
+        else if (is_required) {
+            throw invalid_argument("there is required prefix");
+        }
+        is_prefix = true;
+        text.remove_suffix(1);
+    }
+    return {text, is_minus, is_required, !is_prefix && IsStopWord(text), is_prefix};
+}
+
+vector<TermId> SearchServer::ExpandPrefix(string_view prefix, bool is_excluded) const {
+    // Dropping some of the words would let documents through that should not be
+    vector<TermId> term_ids = term_dictionary_.FindByPrefix(prefix, is_excluded ? SIZE_MAX : MAX_PREFIX_MATCHES);
+    // Terms only used by removed documents stay in the dictionary until compaction
+    term_ids.erase(remove_if(term_ids.begin(), term_ids.end(), [this](const TermId term_id) {
+        return term_statistics_[term_id].document_freq == 0;
+    }), term_ids.end());
+    if (!is_excluded && term_ids.size() > MAX_PREFIX_EXPANSION) {
+        nth_element(term_ids.begin(), term_ids.begin() + MAX_PREFIX_EXPANSION, term_ids.end(),
+                    [this](const TermId lhs, const TermId rhs) {
+            const uint32_t lhs_freq = term_statistics_[lhs].document_freq;
+            const uint32_t rhs_freq = term_statistics_[rhs].document_freq;
+            return lhs_freq > rhs_freq || (lhs_freq == rhs_freq && lhs < rhs);
+        });
+        term_ids.resize(MAX_PREFIX_EXPANSION);
+    }
+    sort(term_ids.begin(), term_ids.end());
+    return term_ids;
 }
 
 SearchServer::Query SearchServer::ParseQuery(string_view text) const {
@@ -161,56 +283,185 @@ SearchServer::Query SearchServer::ParseQuery(bool isErasedDuplicates, string_vie
     Query query;
     auto& minus_words = query.minus_words;
     auto& plus_words = query.plus_words;
+    auto& required_words = query.required_words;
     for (const auto& word : SplitIntoWords(text)) {
         const QueryWord query_word = ParseQueryWord(word);
-        if (!query_word.is_stop) {
-            if (query_word.is_minus) {
-                minus_words.push_back(query_word.data);
+        if (query_word.is_stop) {
+            continue;
+        }
+        if (query_word.is_prefix) {
+            for (const TermId term_id : ExpandPrefix(query_word.data, query_word.is_minus)) {
+                (query_word.is_minus ? minus_words : plus_words).push_back(term_id);
             }
-            else {
-                plus_words.push_back(query_word.data);
+            continue;
+        }
+        const TermId term_id = term_dictionary_.Find(query_word.data);
+        if (term_id == TermDictionary::NOT_FOUND) {
+            query.has_absent_required_word = query.has_absent_required_word || query_word.is_required;
+            continue;
+        }
+        if (query_word.is_minus) {
+            minus_words.push_back(term_id);
+        }
+        else {
+            plus_words.push_back(term_id);
+            if (query_word.is_required) {
+                required_words.push_back(term_id);
             }
         }
     }
     if (isErasedDuplicates) {
         std::sort(minus_words.begin(), minus_words.end());
         std::sort(plus_words.begin(), plus_words.end());
+        std::sort(required_words.begin(), required_words.end());
 
         auto last = std::unique(minus_words.begin(), minus_words.end());
         minus_words.erase(last, minus_words.end());
 
         last = std::unique(plus_words.begin(), plus_words.end());
         plus_words.erase(last, plus_words.end());
+
+        last = std::unique(required_words.begin(), required_words.end());
+        required_words.erase(last, required_words.end());
     }
     return query;
 }
 
 
-double SearchServer::ComputeWordInverseDocumentFreq(const string_view word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+uint32_t SearchServer::GetDocumentOrdinal(int document_id) const {
+    const auto it = document_ordinals_.find(document_id);
+    if (it == document_ordinals_.end()) {
+        throw out_of_range("There is no document with such id");
+    }
+    return it->second;
 }
 
-vector<int>::iterator SearchServer::begin() {
-    return indexes.begin();
+double SearchServer::ComputeWordInverseDocumentFreq(TermId term_id) const {
+    TermStatistics& statistics = term_statistics_[term_id];
+    if (atomic_ref(statistics.epoch).load(memory_order_acquire) != statistics_epoch_) {
+        UpdateTermStatistics(statistics);
+    }
+    return atomic_ref(statistics.inverse_document_freq).load(memory_order_relaxed);
 }
 
+uint32_t SearchServer::GetStatisticsDocumentFreq(TermId term_id) const {
+    TermStatistics& statistics = term_statistics_[term_id];
+    if (atomic_ref(statistics.epoch).load(memory_order_acquire) != statistics_epoch_) {
+        UpdateTermStatistics(statistics);
+    }
+    return atomic_ref(statistics.epoch_document_freq).load(memory_order_relaxed);
+}
 
-vector<int>::iterator SearchServer::end()  {
-    return indexes.end();
+// Concurrent updates store the same values, so the race between them is benign
+void SearchServer::UpdateTermStatistics(TermStatistics& statistics) const {
+    const uint32_t document_freq = statistics.document_freq;
+    atomic_ref(statistics.epoch_document_freq).store(document_freq, memory_order_relaxed);
+    atomic_ref(statistics.inverse_document_freq).store(
+            TfIdf::ComputeTermWeight(statistics_document_count_, document_freq), memory_order_relaxed);
+    atomic_ref(statistics.epoch).store(statistics_epoch_, memory_order_release);
 }
 
-const map<string_view, double> & SearchServer::GetWordFrequencies(int document_id) const {
-    static map<string_view, double> ret;
-    if (!ret.empty()) {
-        ret.clear();
+void SearchServer::OnCollectionChanged() {
+    ++index_version_;
+    if (!are_statistics_frozen_) {
+        statistics_document_count_ = GetDocumentCount();
+        statistics_total_length_ = total_length_;
+        ++statistics_epoch_;
     }
+}
 
-    for (const auto& [word, second_map] : word_to_document_freqs_) {
-        if(second_map.find(document_id) != second_map.end()) {
-            ret[word] = second_map.at(document_id);
+void SearchServer::FreezeCollectionStatistics() {
+    are_statistics_frozen_ = true;
+    RefreshCollectionStatistics();
+}
+
+void SearchServer::RefreshCollectionStatistics() {
+    statistics_document_count_ = GetDocumentCount();
+    statistics_total_length_ = total_length_;
+    ++statistics_epoch_;
+    for (TermId term_id = 0; term_id < term_statistics_.size(); ++term_id) {
+        if (term_statistics_[term_id].document_freq != 0) {
+            ComputeWordInverseDocumentFreq(term_id);
         }
     }
-    return ret;
+}
+
+void SearchServer::UnfreezeCollectionStatistics() {
+    are_statistics_frozen_ = false;
+    OnCollectionChanged();
+}
+
+vector<string_view> SearchServer::GetSortedWords(const vector<TermId>& term_ids) const {
+    vector<string_view> words;
+    words.reserve(term_ids.size());
+    for (const TermId term_id : term_ids) {
+        words.push_back(term_dictionary_.GetTerm(term_id));
+    }
+    sort(words.begin(), words.end());
+    return words;
+}
+
+SearchServer::DocumentIdIterator::DocumentIdIterator(const SearchServer& search_server, uint32_t ordinal)
+        : search_server_(&search_server), ordinal_(ordinal) {
+    SkipRemoved();
+}
+
+const int& SearchServer::DocumentIdIterator::operator*() const {
+    return search_server_->document_ids_[ordinal_];
+}
+
+SearchServer::DocumentIdIterator& SearchServer::DocumentIdIterator::operator++() {
+    ++ordinal_;
+    SkipRemoved();
+    return *this;
+}
+
+SearchServer::DocumentIdIterator SearchServer::DocumentIdIterator::operator++(int) {
+    DocumentIdIterator previous = *this;
+    ++*this;
+    return previous;
+}
+
+bool SearchServer::DocumentIdIterator::operator==(const DocumentIdIterator& other) const {
+    return ordinal_ == other.ordinal_;
+}
+
+bool SearchServer::DocumentIdIterator::operator!=(const DocumentIdIterator& other) const {
+    return !(*this == other);
+}
+
+void SearchServer::DocumentIdIterator::SkipRemoved() {
+    const auto& tombstones = search_server_->tombstones_;
+    while (ordinal_ < tombstones.size() && tombstones[ordinal_]) {
+        ++ordinal_;
+    }
+}
+
+SearchServer::DocumentIdIterator SearchServer::begin() const {
+    return DocumentIdIterator(*this, 0);
+}
+
+SearchServer::DocumentIdIterator SearchServer::end() const {
+    return DocumentIdIterator(*this, static_cast<uint32_t>(document_ids_.size()));
+}
+
+map<string_view, double> SearchServer::GetWordFrequencies(int document_id) const {
+    map<string_view, double> word_frequencies;
+    const auto it = document_ordinals_.find(document_id);
+    if (it != document_ordinals_.end()) {
+        const DocumentTerms& document_terms = document_terms_[it->second];
+        for (size_t i = 0; i < document_terms.term_ids.size(); ++i) {
+            word_frequencies.emplace(term_dictionary_.GetTerm(document_terms.term_ids[i]),
+                                     ComputeTermFreq(document_terms.term_counts[i], document_lengths_[it->second]));
+        }
+    }
+    return word_frequencies;
+}
+
+const vector<TermId>& SearchServer::GetDocumentTerms(int document_id) const {
+    static const vector<TermId> empty_terms;
+    const auto it = document_ordinals_.find(document_id);
+    return it == document_ordinals_.end() ? empty_terms : document_terms_[it->second].term_ids;
 }
 
 void SearchServer::RemoveDocument(int document_id) {
@@ -218,73 +469,822 @@ void SearchServer::RemoveDocument(int document_id) {
 }
 
 void SearchServer::RemoveDocument(const execution::sequenced_policy &seqOrParRem, int document_id) {
-    {
-        auto it = documents_.find(document_id);
-        if (it != documents_.end()) {
-            documents_.erase(it);
+    RemoveDocuments(seqOrParRem, span<const int>(&document_id, 1));
+}
+
+void SearchServer::RemoveDocument(const execution::parallel_policy &seqOrParRem, int document_id) {
+    const vector<uint32_t> ordinals = MarkRemoved(span<const int>(&document_id, 1));
+    if (ordinals.empty()) {
+        return;
+    }
+    DocumentTerms& document_terms = document_terms_[ordinals.front()];
+    for_each(seqOrParRem, document_terms.term_ids.begin(), document_terms.term_ids.end(), [this](const TermId term_id) {
+        --term_statistics_[term_id].document_freq;
+    });
+    document_terms = {};
+    OnCollectionChanged();
+    CompactIfNeeded();
+}
+
+void SearchServer::RemoveDocuments(span<const int> document_ids) {
+    RemoveDocuments(execution::seq, document_ids);
+}
+
+void SearchServer::RemoveDocuments(const execution::sequenced_policy&, span<const int> document_ids) {
+    const vector<uint32_t> ordinals = MarkRemoved(document_ids);
+    if (ordinals.empty()) {
+        return;
+    }
+    for (const uint32_t ordinal : ordinals) {
+        DocumentTerms& document_terms = document_terms_[ordinal];
+        for (const TermId term_id : document_terms.term_ids) {
+            --term_statistics_[term_id].document_freq;
+        }
+        document_terms = {};
+    }
+    OnCollectionChanged();
+    CompactIfNeeded();
+}
+
+void SearchServer::RemoveDocuments(const execution::parallel_policy &seqOrParRem, span<const int> document_ids) {
+    const vector<uint32_t> ordinals = MarkRemoved(document_ids);
+    if (ordinals.empty()) {
+        return;
+    }
+    // Documents share terms, so the frequencies are decremented atomically
+    for_each(seqOrParRem, ordinals.begin(), ordinals.end(), [this](const uint32_t ordinal) {
+        DocumentTerms& document_terms = document_terms_[ordinal];
+        for (const TermId term_id : document_terms.term_ids) {
+            atomic_ref(term_statistics_[term_id].document_freq).fetch_sub(1, memory_order_relaxed);
+        }
+        document_terms = {};
+    });
+    OnCollectionChanged();
+    CompactIfNeeded();
+}
+
+vector<uint32_t> SearchServer::MarkRemoved(span<const int> document_ids) {
+    vector<uint32_t> ordinals;
+    ordinals.reserve(document_ids.size());
+    for (const int document_id : document_ids) {
+        const auto it = document_ordinals_.find(document_id);
+        if (it == document_ordinals_.end()) {
+            continue;
+        }
+        ordinals.push_back(it->second);
+        tombstones_[it->second] = true;
+        total_length_ -= document_lengths_[it->second];
+        document_ordinals_.erase(it);
+    }
+    tombstone_count_ += ordinals.size();
+    return ordinals;
+}
+
+SearchServer::Compaction SearchServer::PrepareCompaction() const {
+    Compaction compaction;
+    compaction.index_version_ = index_version_;
+    auto& new_ordinals = compaction.new_ordinals_;
+    new_ordinals.resize(document_ids_.size(), PostingList::END_ORDINAL);
+    uint32_t next_ordinal = 0;
+    for (uint32_t ordinal = 0; ordinal < document_ids_.size(); ++ordinal) {
+        if (!tombstones_[ordinal]) {
+            new_ordinals[ordinal] = next_ordinal++;
+        }
+    }
+
+    // Only the terms of live documents are copied to the new dictionary
+    auto& new_term_ids = compaction.new_term_ids_;
+    new_term_ids.resize(postings_.size(), TermDictionary::NOT_FOUND);
+    vector<TermId> term_ids;
+    for (TermId term_id = 0; term_id < postings_.size(); ++term_id) {
+        if (term_statistics_[term_id].document_freq != 0) {
+            new_term_ids[term_id] = compaction.term_dictionary_.Insert(term_dictionary_.GetTerm(term_id));
+            term_ids.push_back(term_id);
         }
     }
 
-    {
-        auto it = find(indexes.begin(), indexes.end(), document_id);
-        if (it != indexes.end()) {
-            indexes.erase(it);
+    // Renumbering keeps the order of the ordinals, so the lists stay sorted
+    compaction.postings_.resize(term_ids.size());
+    if (are_impacts_enabled_) {
+        compaction.impacts_.resize(term_ids.size());
+    }
+    if (are_impact_orders_enabled_) {
+        compaction.impact_orders_.resize(term_ids.size());
+    }
+    compaction.term_bitmaps_.resize(term_ids.size());
+    for_each(execution::par, term_ids.begin(), term_ids.end(), [&](const TermId term_id) {
+        const TermId new_term_id = new_term_ids[term_id];
+        vector<pair<uint16_t, uint32_t>> term_impacts;
+        for (size_t status = 0; status < STATUS_COUNT; ++status) {
+            PostingList& compacted = compaction.postings_[new_term_id][status];
+            size_t position = 0;
+            for (PostingList::Cursor cursor(postings_[term_id][status]); cursor.GetOrdinal() != PostingList::END_ORDINAL;
+                 cursor.Next(), ++position) {
+                const uint32_t ordinal = cursor.GetOrdinal();
+                if (tombstones_[ordinal]) {
+                    continue;
+                }
+                compacted.Append(new_ordinals[ordinal], cursor.GetTermCount(), document_lengths_[ordinal]);
+                if (are_impacts_enabled_) {
+                    compaction.impacts_[new_term_id][status].push_back(impacts_[term_id][status][position]);
+                }
+                term_impacts.emplace_back(TfIdf::ComputeImpact(cursor.GetTermCount(), document_lengths_[ordinal]),
+                                          new_ordinals[ordinal]);
+            }
+        }
+        if (term_impacts.size() >= MIN_TERM_BITMAP_SIZE) {
+            RoaringBitmap& bitmap = compaction.term_bitmaps_[new_term_id];
+            for (const auto& [impact, ordinal] : term_impacts) {
+                bitmap.Add(ordinal);
+            }
+            bitmap.Optimize();
+        }
+        if (are_impact_orders_enabled_ && term_impacts.size() >= MIN_IMPACT_ORDER_SIZE) {
+            compaction.impact_orders_[new_term_id] = MakeImpactOrder(move(term_impacts));
         }
+    });
+    return compaction;
+}
+
+bool SearchServer::CommitCompaction(Compaction&& compaction) {
+    if (compaction.index_version_ != index_version_) {
+        return false;
     }
+    const auto& new_ordinals = compaction.new_ordinals_;
+    const auto& new_term_ids = compaction.new_term_ids_;
+    postings_ = move(compaction.postings_);
+    impacts_ = move(compaction.impacts_);
+    impact_orders_ = move(compaction.impact_orders_);
+    term_bitmaps_ = move(compaction.term_bitmaps_);
+    term_dictionary_ = move(compaction.term_dictionary_);
+    // Both renumberings are monotonic, so entries only move towards the front
+    // and the term ids of every document stay sorted
+    for (TermId term_id = 0; term_id < new_term_ids.size(); ++term_id) {
+        if (new_term_ids[term_id] != TermDictionary::NOT_FOUND) {
+            term_statistics_[new_term_ids[term_id]] = term_statistics_[term_id];
+        }
+    }
+    term_statistics_.resize(postings_.size());
+    for (auto& [document_id, ordinal] : document_ordinals_) {
+        ordinal = new_ordinals[ordinal];
+    }
+    size_t live_count = 0;
+    for (uint32_t ordinal = 0; ordinal < document_ids_.size(); ++ordinal) {
+        if (tombstones_[ordinal]) {
+            continue;
+        }
+        for (TermId& term_id : document_terms_[ordinal].term_ids) {
+            term_id = new_term_ids[term_id];
+        }
+        if (live_count != ordinal) {
+            document_ids_[live_count] = document_ids_[ordinal];
+            document_ratings_[live_count] = document_ratings_[ordinal];
+            document_statuses_[live_count] = document_statuses_[ordinal];
+            document_lengths_[live_count] = document_lengths_[ordinal];
+            document_terms_[live_count] = move(document_terms_[ordinal]);
+        }
+        ++live_count;
+    }
+    document_ids_.resize(live_count);
+    document_ratings_.resize(live_count);
+    document_statuses_.resize(live_count);
+    document_lengths_.resize(live_count);
+    document_terms_.resize(live_count);
+    tombstones_.assign(live_count, false);
+    tombstone_count_ = 0;
+    ++index_version_;
+    return true;
+}
 
-    {
-        for (auto& [word, maps] : word_to_document_freqs_) {
-            auto it = maps.find(document_id);
-            if (it != maps.end()) {
-                maps.erase(it);
+void SearchServer::Compact() {
+    if (tombstone_count_ != 0) {
+        CommitCompaction(PrepareCompaction());
+    }
+}
+
+void SearchServer::SetQuantizedImpacts(bool is_enabled) {
+    // A compaction prepared before holds impacts as they were then
+    ++index_version_;
+    are_impacts_enabled_ = is_enabled;
+    impacts_.clear();
+    if (!is_enabled) {
+        return;
+    }
+    impacts_.resize(postings_.size());
+    for (TermId term_id = 0; term_id < postings_.size(); ++term_id) {
+        for (size_t status = 0; status < STATUS_COUNT; ++status) {
+            const PostingList& postings = postings_[term_id][status];
+            vector<uint16_t>& impacts = impacts_[term_id][status];
+            impacts.reserve(postings.size());
+            for (PostingList::Cursor cursor(postings); cursor.GetOrdinal() != PostingList::END_ORDINAL; cursor.Next()) {
+                impacts.push_back(TfIdf::ComputeImpact(cursor.GetTermCount(), document_lengths_[cursor.GetOrdinal()]));
             }
         }
     }
+}
 
-    {
-        auto it = document_to_word_freqs_.find(document_id);
-        if (it != document_to_word_freqs_.end()) {
-            document_to_word_freqs_.erase(it);
+void SearchServer::SetImpactOrders(bool is_enabled) {
+    // A compaction prepared before holds the orders as they were then
+    ++index_version_;
+    are_impact_orders_enabled_ = is_enabled;
+    impact_orders_.clear();
+    if (!is_enabled) {
+        return;
+    }
+    impact_orders_.resize(postings_.size());
+    for (TermId term_id = 0; term_id < postings_.size(); ++term_id) {
+        if (GetPostingCount(term_id) >= MIN_IMPACT_ORDER_SIZE) {
+            impact_orders_[term_id] = MakeImpactOrder(term_id);
         }
     }
 }
 
-void SearchServer::RemoveDocument(const execution::parallel_policy &seqOrParRem, int document_id) {
-    {
-        auto it = find( indexes.begin(), indexes.end(), document_id);
-        if (it != indexes.end()) {
-            indexes.erase(it);
+void SearchServer::SetPositionalIndex(bool is_enabled) {
+    // The text of the documents added before is not kept to record their positions
+    if (is_enabled && !are_positions_enabled_ && !document_ordinals_.empty()) {
+        throw invalid_argument("Positional index can only be enabled while the index is empty");
+    }
+    are_positions_enabled_ = is_enabled;
+    if (!is_enabled) {
+        for (DocumentTerms& document_terms : document_terms_) {
+            document_terms.position_offsets = {};
+            document_terms.positions = {};
+        }
+    }
+}
+
+void SearchServer::EncodePositions(string_view document, const vector<TermId>& word_term_ids,
+                                   DocumentTerms& document_terms) const {
+    vector<pair<TermId, uint32_t>> term_positions;
+    uint32_t position = 0;
+    auto word_term_id = word_term_ids.begin();
+    for (const string_view word : SplitIntoWords(document)) {
+        if (IsStopWord(word)) {
+            ++position;
+            continue;
+        }
+        // Empty words have a term but no position
+        const TermId term_id = *word_term_id++;
+        if (!word.empty()) {
+            term_positions.emplace_back(term_id, position++);
+        }
+    }
+    sort(term_positions.begin(), term_positions.end());
+    document_terms.position_offsets.reserve(document_terms.term_ids.size());
+    auto term_position = term_positions.begin();
+    for (const TermId term_id : document_terms.term_ids) {
+        document_terms.position_offsets.push_back(static_cast<uint32_t>(document_terms.positions.size()));
+        uint32_t previous = 0;
+        for (; term_position != term_positions.end() && term_position->first == term_id; ++term_position) {
+            AppendVarint(term_position->second - previous, document_terms.positions);
+            previous = term_position->second;
+        }
+    }
+}
+
+vector<uint32_t> SearchServer::GetTermPositions(uint32_t ordinal, TermId term_id) const {
+    const DocumentTerms& document_terms = document_terms_[ordinal];
+    const auto it = lower_bound(document_terms.term_ids.begin(), document_terms.term_ids.end(), term_id);
+    vector<uint32_t> positions;
+    if (document_terms.position_offsets.empty() || it == document_terms.term_ids.end() || *it != term_id) {
+        return positions;
+    }
+    const size_t index = it - document_terms.term_ids.begin();
+    const uint8_t* data = document_terms.positions.data() + document_terms.position_offsets[index];
+    const uint8_t* const end = document_terms.positions.data() + (index + 1 < document_terms.position_offsets.size()
+            ? document_terms.position_offsets[index + 1] : document_terms.positions.size());
+    uint32_t position = 0;
+    while (data != end) {
+        position += ReadVarint(data);
+        positions.push_back(position);
+    }
+    return positions;
+}
+
+SearchServer::ImpactOrder SearchServer::MakeImpactOrder(vector<pair<uint16_t, uint32_t>> postings) {
+    // Ties keep the earlier ordinal in front, as appending does
+    const size_t size = min(postings.size(), IMPACT_ORDER_SIZE);
+    partial_sort(postings.begin(), postings.begin() + size, postings.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+    });
+    ImpactOrder order;
+    order.ordinals.reserve(size);
+    order.impacts.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        order.impacts.push_back(postings[i].first);
+        order.ordinals.push_back(postings[i].second);
+    }
+    for (size_t i = size; i < postings.size(); ++i) {
+        order.remaining_impact = max(order.remaining_impact, postings[i].first);
+    }
+    return order;
+}
+
+SearchServer::ImpactOrder SearchServer::MakeImpactOrder(TermId term_id) const {
+    vector<pair<uint16_t, uint32_t>> term_impacts;
+    term_impacts.reserve(GetPostingCount(term_id));
+    for (const PostingList& postings : postings_[term_id]) {
+        for (PostingList::Cursor cursor(postings); cursor.GetOrdinal() != PostingList::END_ORDINAL; cursor.Next()) {
+            term_impacts.emplace_back(TfIdf::ComputeImpact(cursor.GetTermCount(), document_lengths_[cursor.GetOrdinal()]),
+                                      cursor.GetOrdinal());
+        }
+    }
+    return MakeImpactOrder(move(term_impacts));
+}
+
+void SearchServer::UpdateImpactOrder(TermId term_id, uint32_t ordinal, uint16_t impact) {
+    if (!are_impact_orders_enabled_) {
+        return;
+    }
+    ImpactOrder& order = impact_orders_[term_id];
+    if (order.ordinals.empty()) {
+        if (GetPostingCount(term_id) >= MIN_IMPACT_ORDER_SIZE) {
+            order = MakeImpactOrder(term_id);
+        }
+        return;
+    }
+    // The order is full, so the new posting either stays out or pushes the last one out
+    if (impact <= order.impacts.back()) {
+        order.remaining_impact = max(order.remaining_impact, impact);
+        return;
+    }
+    order.remaining_impact = max(order.remaining_impact, order.impacts.back());
+    order.impacts.pop_back();
+    order.ordinals.pop_back();
+    const auto position = upper_bound(order.impacts.begin(), order.impacts.end(), impact, greater<>())
+            - order.impacts.begin();
+    order.impacts.insert(order.impacts.begin() + position, impact);
+    order.ordinals.insert(order.ordinals.begin() + position, ordinal);
+}
+
+void SearchServer::UpdateTermBitmap(TermId term_id, uint32_t ordinal) {
+    RoaringBitmap& bitmap = term_bitmaps_[term_id];
+    if (!bitmap.empty()) {
+        bitmap.Add(ordinal);
+        return;
+    }
+    if (GetPostingCount(term_id) < MIN_TERM_BITMAP_SIZE) {
+        return;
+    }
+    for (const PostingList& postings : postings_[term_id]) {
+        for (PostingList::Cursor cursor(postings); cursor.GetOrdinal() != PostingList::END_ORDINAL; cursor.Next()) {
+            bitmap.Add(cursor.GetOrdinal());
         }
     }
+    bitmap.Optimize();
+}
+
+bool SearchServer::HasTerm(uint32_t ordinal, DocumentStatus status, TermId term_id) const {
+    if (!term_bitmaps_[term_id].empty()) {
+        return term_bitmaps_[term_id].Contains(ordinal);
+    }
+    return postings_[term_id][static_cast<size_t>(status)].Contains(ordinal);
+}
+
+void SearchServer::ExcludeMinusWords(ScoreAccumulator& accumulator, const Query& query, StatusPartitions statuses) const {
+    const size_t ordinal_count = document_ids_.size();
+    for (const TermId term_id : query.minus_words) {
+        if (!term_bitmaps_[term_id].empty()) {
+            term_bitmaps_[term_id].OrInto(0, ordinal_count, accumulator.GetExcludedWords(ordinal_count));
+            continue;
+        }
+        for (size_t status = statuses.first; status < statuses.last; ++status) {
+            for (PostingList::Cursor cursor(postings_[term_id][status]); cursor.GetOrdinal() != PostingList::END_ORDINAL;
+                 cursor.Next()) {
+                accumulator.Exclude(cursor.GetOrdinal());
+            }
+        }
+    }
+}
+
+size_t SearchServer::GetPostingCount(TermId term_id) const {
+    size_t posting_count = 0;
+    for (const PostingList& postings : postings_[term_id]) {
+        posting_count += postings.size();
+    }
+    return posting_count;
+}
 
-    {
-        auto it = find_if(seqOrParRem, documents_.begin(), documents_.end(), [document_id](const auto& doc){
-            return doc.first == document_id;
+uint32_t SearchServer::GetDocumentTermCount(uint32_t ordinal, TermId term_id) const {
+    const DocumentTerms& document_terms = document_terms_[ordinal];
+    const auto it = lower_bound(document_terms.term_ids.begin(), document_terms.term_ids.end(), term_id);
+    if (it == document_terms.term_ids.end() || *it != term_id) {
+        return 0;
+    }
+    return document_terms.term_counts[it - document_terms.term_ids.begin()];
+}
+
+vector<uint32_t> SearchServer::IntersectTerms(const vector<TermId>& term_ids, StatusPartitions statuses) const {
+    vector<uint32_t> ordinals;
+    // Frequent terms are intersected through their bitmaps, word by word where
+    // both sides are dense and by lookups into the denser side otherwise
+    const auto has_bitmap = [this](const TermId term_id) {
+        return !term_bitmaps_[term_id].empty();
+    };
+    if (term_ids.size() > 1 && all_of(term_ids.begin(), term_ids.end(), has_bitmap)) {
+        vector<const RoaringBitmap*> bitmaps;
+        for (const TermId term_id : term_ids) {
+            bitmaps.push_back(&term_bitmaps_[term_id]);
+        }
+        sort(bitmaps.begin(), bitmaps.end(), [](const RoaringBitmap* lhs, const RoaringBitmap* rhs) {
+            return lhs->size() < rhs->size();
         });
-        if (it != documents_.end()) {
-            documents_.erase(it);
+        RoaringBitmap intersection = RoaringBitmap::And(*bitmaps[0], *bitmaps[1]);
+        for (size_t i = 2; i < bitmaps.size() && !intersection.empty(); ++i) {
+            intersection = RoaringBitmap::And(intersection, *bitmaps[i]);
         }
+        intersection.ForEach([&ordinals](const uint32_t ordinal) {
+            ordinals.push_back(ordinal);
+        });
+        return ordinals;
     }
 
-    {
-        if (document_to_word_freqs_.find(document_id) != document_to_word_freqs_.end()) {
-            auto& mapa = document_to_word_freqs_.at(document_id);
-            vector<string_view> strs(mapa.size(), "");
-            transform(seqOrParRem, mapa.begin(), mapa.end(), strs.begin(), [](const auto& docs) {
-                return docs.first;
-            });
-            for_each(seqOrParRem, strs.begin(), strs.end(), [this, document_id](const auto& str) {
-                word_to_document_freqs_.at(str).erase(document_id);
+    // Otherwise the shortest list proposes ordinals and the others gallop to
+    // them, partition by partition
+    for (size_t status = statuses.first; status < statuses.last; ++status) {
+        vector<TermId> sorted_term_ids = term_ids;
+        sort(sorted_term_ids.begin(), sorted_term_ids.end(), [this, status](const TermId lhs, const TermId rhs) {
+            return postings_[lhs][status].size() < postings_[rhs][status].size();
+        });
+        vector<PostingList::Cursor> cursors;
+        for (const TermId term_id : sorted_term_ids) {
+            cursors.emplace_back(postings_[term_id][status]);
+        }
+        uint32_t target = cursors[0].GetOrdinal();
+        while (target != PostingList::END_ORDINAL) {
+            bool is_common = true;
+            for (size_t i = 1; i < cursors.size(); ++i) {
+                cursors[i].SkipTo(target);
+                if (cursors[i].GetOrdinal() != target) {
+                    is_common = false;
+                    target = cursors[i].GetOrdinal();
+                    break;
+                }
+            }
+            if (is_common) {
+                ordinals.push_back(target);
+                cursors[0].Next();
+            }
+            else {
+                cursors[0].SkipTo(target);
+            }
+            target = cursors[0].GetOrdinal();
+        }
+    }
+    return ordinals;
+}
+
+SearchServer::QueryPlanNode SearchServer::MakePlanNode(QueryPlanNode::Kind kind, TermId term_id, size_t estimated_size) {
+    QueryPlanNode node;
+    node.kind = kind;
+    node.term_id = term_id;
+    node.estimated_size = estimated_size;
+    return node;
+}
+
+optional<SearchServer::QueryPlanNode> SearchServer::CompileBooleanQuery(const BooleanQueryNode& node,
+                                                                       bool is_excluded) const {
+    using Kind = QueryPlanNode::Kind;
+    const size_t document_count = document_ordinals_.size();
+    switch (node.kind) {
+        case BooleanQueryNode::Kind::WORD: {
+            const QueryWord query_word = ParseQueryWord(node.word);
+            if (query_word.is_stop) {
+                return nullopt;
+            }
+            if (query_word.is_prefix) {
+                QueryPlanNode plan = MakePlanNode(Kind::OR);
+                for (const TermId term_id : ExpandPrefix(query_word.data, is_excluded)) {
+                    plan.children.push_back(MakePlanNode(Kind::TERM, term_id, term_statistics_[term_id].document_freq));
+                    plan.estimated_size += plan.children.back().estimated_size;
+                }
+                if (plan.children.size() <= 1) {
+                    return plan.children.empty() ? MakePlanNode(Kind::EMPTY) : move(plan.children.front());
+                }
+                plan.estimated_size = min(plan.estimated_size, document_count);
+                return plan;
+            }
+            const TermId term_id = term_dictionary_.Find(query_word.data);
+            if (term_id == TermDictionary::NOT_FOUND || term_statistics_[term_id].document_freq == 0) {
+                return MakePlanNode(Kind::EMPTY);
+            }
+            return MakePlanNode(Kind::TERM, term_id, term_statistics_[term_id].document_freq);
+        }
+        case BooleanQueryNode::Kind::NOT: {
+            optional<QueryPlanNode> child = CompileBooleanQuery(node.children.front(), !is_excluded);
+            if (!child) {
+                return nullopt;
+            }
+            QueryPlanNode plan = MakePlanNode(Kind::NOT, TermDictionary::NOT_FOUND,
+                                              document_count - min(child->estimated_size, document_count));
+            plan.children.push_back(move(*child));
+            return plan;
+        }
+        case BooleanQueryNode::Kind::PHRASE: {
+            if (!are_positions_enabled_) {
+                throw invalid_argument("Positional index is disabled");
+            }
+            // Stop words match any word between the others, so offsets are
+            // counted from the first word that is not a stop word
+            QueryPlanNode plan = MakePlanNode(Kind::PHRASE, TermDictionary::NOT_FOUND, document_count);
+            uint32_t first_offset = 0;
+            for (uint32_t offset = 0; offset < node.children.size(); ++offset) {
+                optional<QueryPlanNode> word = CompileBooleanQuery(node.children[offset], is_excluded);
+                if (!word) {
+                    continue;
+                }
+                if (plan.children.empty()) {
+                    first_offset = offset;
+                }
+                plan.estimated_size = min(plan.estimated_size, word->estimated_size);
+                plan.children.push_back(move(*word));
+                plan.phrase_offsets.push_back(offset - first_offset);
+            }
+            if (plan.children.size() <= 1) {
+                return plan.children.empty() ? nullopt : optional<QueryPlanNode>(move(plan.children.front()));
+            }
+            return plan;
+        }
+        default: {
+            const bool is_and = node.kind == BooleanQueryNode::Kind::AND;
+            QueryPlanNode plan = MakePlanNode(is_and ? Kind::AND : Kind::OR);
+            for (const BooleanQueryNode& child : node.children) {
+                if (optional<QueryPlanNode> compiled = CompileBooleanQuery(child, is_excluded)) {
+                    plan.children.push_back(move(*compiled));
+                }
+            }
+            if (plan.children.size() <= 1) {
+                return plan.children.empty() ? nullopt : optional<QueryPlanNode>(move(plan.children.front()));
+            }
+            sort(plan.children.begin(), plan.children.end(), [](const QueryPlanNode& lhs, const QueryPlanNode& rhs) {
+                return lhs.estimated_size < rhs.estimated_size;
             });
-            document_to_word_freqs_.erase(document_id);
+            for (const QueryPlanNode& child : plan.children) {
+                plan.estimated_size += child.estimated_size;
+            }
+            plan.estimated_size = is_and ? plan.children.front().estimated_size : min(plan.estimated_size, document_count);
+            return plan;
         }
     }
 }
 
+RoaringBitmap SearchServer::EvaluateQueryPlan(const QueryPlanNode& node, StatusPartitions statuses) const {
+    using Kind = QueryPlanNode::Kind;
+    switch (node.kind) {
+        case Kind::TERM:
+            if (statuses.first == 0 && statuses.last == STATUS_COUNT && !term_bitmaps_[node.term_id].empty()) {
+                return term_bitmaps_[node.term_id];
+            }
+            break;
+        case Kind::EMPTY:
+            return {};
+        case Kind::NOT:
+            return RoaringBitmap::AndNot(GetStatusDocuments(statuses), EvaluateQueryPlan(node.children.front(), statuses));
+        case Kind::OR: {
+            // Term children, such as the expansion of a prefix, are united at once
+            vector<TermId> term_ids;
+            for (const QueryPlanNode& child : node.children) {
+                if (child.kind == Kind::TERM) {
+                    term_ids.push_back(child.term_id);
+                }
+            }
+            RoaringBitmap result = UniteTerms(term_ids, statuses);
+            for (const QueryPlanNode& child : node.children) {
+                if (child.kind != Kind::TERM) {
+                    result = RoaringBitmap::Or(result, EvaluateQueryPlan(child, statuses));
+                }
+            }
+            return result;
+        }
+        case Kind::PHRASE: {
+            // Positions are read only for the documents holding every word
+            vector<TermId> term_ids;
+            for (const QueryPlanNode& child : node.children) {
+                if (child.kind == Kind::EMPTY) {
+                    return {};
+                }
+                term_ids.push_back(child.term_id);
+            }
+            vector<uint32_t> ordinals = IntersectTerms(term_ids, statuses);
+            sort(ordinals.begin(), ordinals.end());
+            RoaringBitmap result;
+            for (const uint32_t ordinal : ordinals) {
+                if (!tombstones_[ordinal] && MatchesPhrase(node, ordinal)) {
+                    result.Add(ordinal);
+                }
+            }
+            return result;
+        }
+        case Kind::AND:
+            break;
+    }
+
+    // Terms, and the term children of AND, go through IntersectTerms, which picks
+    // bitmaps or galloping cursors. The other children follow from the most
+    // selective, and NOT children are subtracted rather than complemented.
+    vector<TermId> term_ids;
+    if (node.kind == Kind::TERM) {
+        term_ids.push_back(node.term_id);
+    }
+    for (const QueryPlanNode& child : node.children) {
+        if (child.kind == Kind::EMPTY) {
+            return {};
+        }
+        if (child.kind == Kind::TERM) {
+            term_ids.push_back(child.term_id);
+        }
+    }
+    RoaringBitmap result;
+    if (!term_ids.empty()) {
+        vector<uint32_t> ordinals = IntersectTerms(term_ids, statuses);
+        sort(ordinals.begin(), ordinals.end());
+        for (const uint32_t ordinal : ordinals) {
+            result.Add(ordinal);
+        }
+    }
+    bool has_positive = !term_ids.empty();
+    for (const QueryPlanNode& child : node.children) {
+        if (child.kind == Kind::TERM || child.kind == Kind::NOT) {
+            continue;
+        }
+        result = has_positive ? RoaringBitmap::And(result, EvaluateQueryPlan(child, statuses))
+                              : EvaluateQueryPlan(child, statuses);
+        has_positive = true;
+        if (result.empty()) {
+            return result;
+        }
+    }
+    if (!has_positive) {
+        result = GetStatusDocuments(statuses);
+    }
+    for (const QueryPlanNode& child : node.children) {
+        if (child.kind == Kind::NOT && !result.empty()) {
+            result = RoaringBitmap::AndNot(result, EvaluateQueryPlan(child.children.front(), statuses));
+        }
+    }
+    return result;
+}
+
+RoaringBitmap SearchServer::UniteTerms(const vector<TermId>& term_ids, StatusPartitions statuses) const {
+    // Bitmaps of frequent terms are ORed word by word; the postings of all the
+    // short lists are gathered and sorted once, instead of a bitmap per list
+    RoaringBitmap result;
+    vector<uint32_t> ordinals;
+    for (const TermId term_id : term_ids) {
+        if (!term_bitmaps_[term_id].empty()) {
+            result = RoaringBitmap::Or(result, term_bitmaps_[term_id]);
+            continue;
+        }
+        for (size_t status = statuses.first; status < statuses.last; ++status) {
+            const PostingList& postings = postings_[term_id][status];
+            for (PostingList::Cursor cursor(postings); cursor.GetOrdinal() != PostingList::END_ORDINAL; cursor.Next()) {
+                ordinals.push_back(cursor.GetOrdinal());
+            }
+        }
+    }
+    if (ordinals.empty()) {
+        return result;
+    }
+    sort(ordinals.begin(), ordinals.end());
+    RoaringBitmap short_lists;
+    for (auto it = ordinals.begin(); it != ordinals.end(); it = upper_bound(it, ordinals.end(), *it)) {
+        short_lists.Add(*it);
+    }
+    return RoaringBitmap::Or(result, short_lists);
+}
+
+RoaringBitmap SearchServer::GetStatusDocuments(StatusPartitions statuses) const {
+    RoaringBitmap documents;
+    for (uint32_t ordinal = 0; ordinal < document_ids_.size(); ++ordinal) {
+        const auto status = static_cast<size_t>(document_statuses_[ordinal]);
+        if (!tombstones_[ordinal] && status >= statuses.first && status < statuses.last) {
+            documents.Add(ordinal);
+        }
+    }
+    documents.Optimize();
+    return documents;
+}
+
+bool SearchServer::MatchesQueryPlan(const QueryPlanNode& node, uint32_t ordinal) const {
+    const auto matches = [this, ordinal](const QueryPlanNode& child) {
+        return MatchesQueryPlan(child, ordinal);
+    };
+    switch (node.kind) {
+        case QueryPlanNode::Kind::TERM:
+            return GetDocumentTermCount(ordinal, node.term_id) != 0;
+        case QueryPlanNode::Kind::AND:
+            return all_of(node.children.begin(), node.children.end(), matches);
+        case QueryPlanNode::Kind::OR:
+            return any_of(node.children.begin(), node.children.end(), matches);
+        case QueryPlanNode::Kind::NOT:
+            return !matches(node.children.front());
+        case QueryPlanNode::Kind::PHRASE:
+            return MatchesPhrase(node, ordinal);
+        default:
+            return false;
+    }
+}
+
+bool SearchServer::MatchesPhrase(const QueryPlanNode& node, uint32_t ordinal) const {
+    size_t rarest = 0;
+    uint32_t rarest_count = UINT32_MAX;
+    for (size_t i = 0; i < node.children.size(); ++i) {
+        const uint32_t term_count = GetDocumentTermCount(ordinal, node.children[i].term_id);
+        if (term_count == 0) {
+            return false;
+        }
+        if (term_count < rarest_count) {
+            rarest = i;
+            rarest_count = term_count;
+        }
+    }
+    // Positions where the phrase may start, narrowed word by word
+    vector<uint32_t> starts;
+    for (const uint32_t position : GetTermPositions(ordinal, node.children[rarest].term_id)) {
+        if (position >= node.phrase_offsets[rarest]) {
+            starts.push_back(position - node.phrase_offsets[rarest]);
+        }
+    }
+    for (size_t i = 0; i < node.children.size() && !starts.empty(); ++i) {
+        if (i == rarest) {
+            continue;
+        }
+        const vector<uint32_t> positions = GetTermPositions(ordinal, node.children[i].term_id);
+        auto position = positions.begin();
+        size_t kept = 0;
+        for (const uint32_t start : starts) {
+            const uint32_t target = start + node.phrase_offsets[i];
+            while (position != positions.end() && *position < target) {
+                ++position;
+            }
+            if (position != positions.end() && *position == target) {
+                starts[kept++] = start;
+            }
+        }
+        starts.resize(kept);
+    }
+    return !starts.empty();
+}
+
+void SearchServer::CollectScoredTerms(const QueryPlanNode& node, vector<TermId>& term_ids) {
+    if (node.kind == QueryPlanNode::Kind::TERM) {
+        term_ids.push_back(node.term_id);
+    }
+    else if (node.kind != QueryPlanNode::Kind::NOT) {
+        for (const QueryPlanNode& child : node.children) {
+            CollectScoredTerms(child, term_ids);
+        }
+    }
+}
+
+vector<TermId> SearchServer::MatchBooleanQuery(const BooleanQueryNode& boolean_query, uint32_t ordinal) const {
+    const optional<QueryPlanNode> plan = CompileBooleanQuery(boolean_query);
+    vector<TermId> matched_terms;
+    if (plan && MatchesQueryPlan(*plan, ordinal)) {
+        CollectScoredTerms(*plan, matched_terms);
+        matched_terms.erase(remove_if(matched_terms.begin(), matched_terms.end(), [this, ordinal](const TermId term_id) {
+            return GetDocumentTermCount(ordinal, term_id) == 0;
+        }), matched_terms.end());
+        sort(matched_terms.begin(), matched_terms.end());
+        matched_terms.erase(unique(matched_terms.begin(), matched_terms.end()), matched_terms.end());
+    }
+    return matched_terms;
+}
+
+bool SearchServer::CanUseImpactOrders(const Query& query) const {
+    if (!are_impact_orders_enabled_) {
+        return false;
+    }
+    size_t term_count = 0;
+    for (const TermId term_id : query.plus_words) {
+        if (term_statistics_[term_id].document_freq == 0) {
+            continue;
+        }
+        if (impact_orders_[term_id].ordinals.empty()) {
+            return false;
+        }
+        ++term_count;
+    }
+    return term_count != 0 && term_count <= MAX_IMPACT_ORDER_QUERY_TERMS;
+}
+
+void SearchServer::SetAutoCompaction(bool is_enabled) {
+    is_auto_compaction_enabled_ = is_enabled;
+}
+
+void SearchServer::CompactIfNeeded() {
+    // Tombstones are filtered on every query, so a quarter of them is worth a rewrite
+    if (is_auto_compaction_enabled_ && tombstone_count_ >= MIN_TOMBSTONES_TO_COMPACT
+        && tombstone_count_ * 4 >= document_ids_.size()) {
+        Compact();
+    }
+}
+
 vector<Document> SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(execution::seq,
-                            raw_query, [status]([[maybe_unused]] int document_id, DocumentStatus document_status,
-                                                [[maybe_unused]] int rating) {
-                return document_status == status;
-            });
+    return FindTopDocuments(execution::seq, raw_query, StatusPredicate{status});
+}
+
+vector<Document> SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status,
+                                                int top_count, int offset) const {
+    return FindTopDocuments(execution::seq, raw_query, status, top_count, offset);
 }
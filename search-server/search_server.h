@@ -7,25 +7,62 @@
 #include <map>
 #include <numeric>
 #include <cmath>
+#include <limits>
 #include <execution>
-#include <deque>
+#include <unordered_map>
 #include "document.h"
 #include "string_processing.h"
-#include "concurrent_map.h"
-#include <mutex>
-#include <future>
+#include "term_dictionary.h"
+#include "score_accumulator.h"
+#include "posting_list.h"
+#include "scorers.h"
+#include "impact_kernels.h"
+#include "roaring_bitmap.h"
+#include "boolean_query.h"
+#include <thread>
+#include <atomic>
+#include <span>
+#include <queue>
+#include <optional>
 
 using namespace std;
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 
-enum class DocumentStatus {
+// One byte, so that the status column can be compared 32 values at a time
+enum class DocumentStatus : uint8_t {
     ACTUAL,
     IRRELEVANT,
     BANNED,
     REMOVED,
 };
 
+// Filter of the FindTopDocuments overloads taking a status. Queries evaluate it
+// over the status column in bulk instead of calling it per document.
+struct StatusPredicate {
+    DocumentStatus status;
+
+    bool operator()([[maybe_unused]] int document_id, DocumentStatus document_status,
+                    [[maybe_unused]] int rating) const {
+        return document_status == status;
+    }
+};
+
+// Passed instead of an execution policy to pick how a query is evaluated
+enum class QueryMode {
+    // Scores every posting of the query words. With SetImpactOrders(true), the
+    // sequenced policy may answer short TF-IDF queries from impact orders instead.
+    EXHAUSTIVE,
+    // Document-at-a-time evaluation that skips documents which cannot reach the top
+    MAX_SCORE,
+    // TF-IDF from 16-bit quantized term frequencies summed in integers, within
+    // about 1e-4 of the exact relevance. Needs SetQuantizedImpacts(true).
+    QUANTIZED,
+    // Term-at-a-time over consecutive ordinal ranges small enough for the
+    // score accumulator to stay in cache, for very large collections
+    BLOCKED,
+};
+
 class SearchServer {
 public:
     inline static constexpr int INVALID_DOCUMENT_ID = -1;
@@ -42,20 +79,46 @@ public:
 
     int GetDocumentId(int index);
 
-    template <typename DocumentPredicate, typename Policy>
+    // In a raw query "-word" excludes the documents containing the word and
+    // "+word" keeps only those containing it; plain words just add relevance.
+    // Well formed queries with parentheses, quoted phrases or the operators AND,
+    // OR and NOT are boolean instead, see boolean_query.h; their words outside
+    // NOT add relevance. Phrases need SetPositionalIndex(true).
+    // In both kinds "word*" stands for the indexed words starting with "word".
+    // Where it excludes documents, that is all of them. Otherwise it is at most
+    // MAX_PREFIX_EXPANSION of them: the ones in the most documents among the
+    // first MAX_PREFIX_MATCHES in spelling order.
+    // Plain queries can exclude them with "-word*" but not require them with
+    // '+'; boolean queries exclude them with "NOT word*".
+    // The scorer is the relevance function, TfIdf or Bm25 from scorers.h. Pass
+    // it explicitly to the overloads taking an execution policy or query mode,
+    // e.g. FindTopDocuments<Bm25>(execution::par, raw_query).
+    template <typename Scorer = TfIdf, typename DocumentPredicate, typename Policy>
     vector<Document> FindTopDocuments(Policy, string_view raw_query,
                                       DocumentPredicate document_predicate) const;
 
+    // Returns at most top_count best documents, skipping the offset best ones
+    template <typename Scorer = TfIdf, typename DocumentPredicate, typename Policy>
+    vector<Document> FindTopDocuments(Policy, string_view raw_query, DocumentPredicate document_predicate,
+                                      int top_count, int offset = 0) const;
+
+    template <typename Scorer = TfIdf, typename PolicyExec>
+    vector<Document> FindTopDocuments(PolicyExec policyExec, string_view raw_query, DocumentStatus status,
+                                      int top_count, int offset = 0) const;
+
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentStatus status,
+                                      int top_count, int offset = 0) const;
+
     template <typename DocumentPredicate>
     vector<Document> FindTopDocuments(string_view raw_query,
                                       DocumentPredicate document_predicate) const;
 
     vector<Document> FindTopDocuments(string_view raw_query, DocumentStatus status) const;
 
-    template <typename PolicyExec>
+    template <typename Scorer = TfIdf, typename PolicyExec>
     vector<Document> FindTopDocuments(PolicyExec policyExec, string_view raw_query) const;
 
-    template <typename PolicyExec>
+    template <typename Scorer = TfIdf, typename PolicyExec>
     vector<Document> FindTopDocuments(PolicyExec policyExec, string_view raw_query, DocumentStatus status) const;
 
     vector<Document> FindTopDocuments(string_view raw_query) const;
@@ -70,10 +133,37 @@ public:
     tuple<vector<string_view>, DocumentStatus>
     MatchDocument(const execution::parallel_policy& seqOrParRem, string_view raw_query, int document_id) const;
 
-    vector<int>::iterator begin();
-    vector<int>::iterator end();
+    // Walks the ids of the documents in the order they were added
+    class DocumentIdIterator {
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = int;
+        using difference_type = ptrdiff_t;
+        using pointer = const int*;
+        using reference = const int&;
+
+        DocumentIdIterator(const SearchServer& search_server, uint32_t ordinal);
 
-    const map<string_view, double> & GetWordFrequencies(int document_id) const;
+        reference operator*() const;
+        DocumentIdIterator& operator++();
+        DocumentIdIterator operator++(int);
+        bool operator==(const DocumentIdIterator& other) const;
+        bool operator!=(const DocumentIdIterator& other) const;
+
+    private:
+        const SearchServer* search_server_;
+        uint32_t ordinal_;
+
+        void SkipRemoved();
+    };
+
+    DocumentIdIterator begin() const;
+    DocumentIdIterator end() const;
+
+    map<string_view, double> GetWordFrequencies(int document_id) const;
+
+    // Sorted ids of the distinct words of the document
+    const vector<TermId>& GetDocumentTerms(int document_id) const;
 
     void RemoveDocument(int document_id);
 
@@ -81,18 +171,153 @@ public:
 
     void RemoveDocument(const execution::sequenced_policy& seqOrParRem, int document_id);
 
+    // Removes the whole batch with a single statistics update and at most one
+    // compaction. Unknown ids are ignored.
+    void RemoveDocuments(span<const int> document_ids);
+
+    void RemoveDocuments(const execution::sequenced_policy& seqOrParRem, span<const int> document_ids);
+
+    void RemoveDocuments(const execution::parallel_policy& seqOrParRem, span<const int> document_ids);
+
+    // While frozen, IDF values stay as they were at the last freeze or refresh,
+    // so scores are comparable across updates until the next explicit refresh
+    void FreezeCollectionStatistics();
+
+    void RefreshCollectionStatistics();
+
+    void UnfreezeCollectionStatistics();
+
+private:
+    struct ImpactOrder;
+
+    // Statuses are never changed, so the postings of a term are split by the
+    // status of their documents and status filters read only their partition
+    inline static constexpr size_t STATUS_COUNT = 4;
+    using TermPostings = array<PostingList, STATUS_COUNT>;
+    // impacts[status][i] belongs to the i-th posting of the status partition
+    using TermImpacts = array<vector<uint16_t>, STATUS_COUNT>;
+
+public:
+    // Removed documents only get a tombstone; compaction drops their postings
+    // and renumbers the remaining documents and terms. Terms no document uses
+    // any more leave the dictionary, which is rebuilt, so compaction invalidates
+    // every word view returned by MatchDocument and GetWordFrequencies before
+    // it; removal alone keeps them valid. The expensive part may run on a
+    // background thread while queries go on, provided nothing is added or
+    // removed until the preparation returns.
+    class Compaction {
+    private:
+        friend class SearchServer;
+        uint64_t index_version_ = 0;
+        vector<uint32_t> new_ordinals_;
+        vector<TermId> new_term_ids_;
+        TermDictionary term_dictionary_;
+        vector<TermPostings> postings_;
+        vector<TermImpacts> impacts_;
+        vector<ImpactOrder> impact_orders_;
+        vector<RoaringBitmap> term_bitmaps_;
+    };
+
+    Compaction PrepareCompaction() const;
+
+    // Returns false and keeps the index as is if documents were added or
+    // removed, or quantized impacts or impact orders switched, after the
+    // compaction was prepared
+    bool CommitCompaction(Compaction&& compaction);
+
+    void Compact();
+
+    // Enabled by default: RemoveDocument compacts once tombstones make up
+    // a quarter of the index
+    void SetAutoCompaction(bool is_enabled);
+
+    // Keeps a quantized TF-IDF impact next to every posting, for QueryMode::QUANTIZED
+    void SetQuantizedImpacts(bool is_enabled);
+
+    // Keeps the postings with the highest TF-IDF impacts of every long list, so
+    // that sequenced TF-IDF queries of one or two words can stop early
+    void SetImpactOrders(bool is_enabled);
+
+    // Records the word positions of the documents, for phrases in boolean
+    // queries. The text is not kept, so enabling throws invalid_argument
+    // unless the index is empty, and disabling drops the positions.
+    void SetPositionalIndex(bool is_enabled);
+
 private:
-    deque<string> storage;
-    vector<int> indexes;
     bool IsValidStopWords() const;
     static bool IsValidWord(string_view word);
-    struct DocumentData {
-        int rating;
-        DocumentStatus status;
+    // Forward index entry: the document's terms sorted by id
+    struct DocumentTerms {
+        vector<TermId> term_ids;
+        vector<uint32_t> term_counts;
+        // With the positional index, the positions of term i are varint-encoded
+        // gaps in positions from position_offsets[i] up to the next offset.
+        // Positions count the stop words too, but not empty words.
+        vector<uint32_t> position_offsets;
+        vector<uint8_t> positions;
+    };
+    TermDictionary term_dictionary_;
+    vector<TermPostings> postings_;
+    vector<TermImpacts> impacts_;
+    bool are_impacts_enabled_ = false;
+    bool are_positions_enabled_ = false;
+
+    // The IMPACT_ORDER_SIZE postings of a long list with the highest quantized
+    // TF-IDF impacts, by decreasing impact, and the highest impact of the
+    // postings left out, zero if none. Removed documents stay until compaction.
+    struct ImpactOrder {
+        vector<uint32_t> ordinals;
+        vector<uint16_t> impacts;
+        uint16_t remaining_impact = 0;
     };
-    map<string_view , map<int, double>> word_to_document_freqs_;
-    map<int, map<string_view, double>> document_to_word_freqs_;
-    map<int, DocumentData> documents_;
+    // Empty while disabled, and for terms with lists shorter than MIN_IMPACT_ORDER_SIZE
+    vector<ImpactOrder> impact_orders_;
+    bool are_impact_orders_enabled_ = false;
+    inline static constexpr size_t MIN_IMPACT_ORDER_SIZE = 1024;
+    inline static constexpr size_t IMPACT_ORDER_SIZE = 256;
+    // Queries with more terms gain too little from early termination
+    inline static constexpr size_t MAX_IMPACT_ORDER_QUERY_TERMS = 2;
+    inline static constexpr size_t MAX_PREFIX_EXPANSION = 256;
+    inline static constexpr size_t MAX_PREFIX_MATCHES = 4096;
+    // Ordinals of the documents containing a frequent term, over all status
+    // partitions, for membership tests and exclusion without decoding postings
+    vector<RoaringBitmap> term_bitmaps_;
+    inline static constexpr size_t MIN_TERM_BITMAP_SIZE = 1024;
+    // Documents are numbered by dense ordinals in the order they were added.
+    // Ordinals of removed documents are not reused.
+    unordered_map<int, uint32_t> document_ordinals_;
+    vector<int> document_ids_;
+    // Attributes are kept in columns, so that filters scan only what they read
+    vector<int> document_ratings_;
+    vector<DocumentStatus> document_statuses_;
+    // Number of words without stop words; term frequency is count / length
+    vector<uint32_t> document_lengths_;
+    vector<DocumentTerms> document_terms_;
+    vector<bool> tombstones_;
+    size_t tombstone_count_ = 0;
+    bool is_auto_compaction_enabled_ = true;
+    // Changes with every addition, removal and compaction
+    uint64_t index_version_ = 0;
+    inline static constexpr size_t MIN_TOMBSTONES_TO_COMPACT = 1024;
+
+    // Queries fill the cache concurrently, hence the atomic_ref accesses
+    struct TermStatistics {
+        alignas(atomic_ref<double>::required_alignment) double inverse_document_freq = 0.0;
+        alignas(atomic_ref<uint64_t>::required_alignment) uint64_t epoch = 0;
+        // Postings of removed documents stay until compaction, so this is not the list size
+        alignas(atomic_ref<uint32_t>::required_alignment) uint32_t document_freq = 0;
+        // Value of document_freq as of epoch
+        alignas(atomic_ref<uint32_t>::required_alignment) uint32_t epoch_document_freq = 0;
+    };
+    mutable vector<TermStatistics> term_statistics_;
+    // Advances whenever the document count or document frequencies change,
+    // unless collection statistics are frozen
+    uint64_t statistics_epoch_ = 1;
+    int statistics_document_count_ = 0;
+    uint64_t statistics_total_length_ = 0;
+    // Sum of the lengths of the documents not removed
+    uint64_t total_length_ = 0;
+    bool are_statistics_frozen_ = false;
     bool IsStopWord(string_view word) const;
     vector<string_view> SplitIntoWordsNoStop(std::string_view text) const;
     static int ComputeAverageRating(const vector<int>& ratings);
@@ -100,14 +325,26 @@ private:
     struct QueryWord {
         string_view data;
         bool is_minus;
+        // Marked with a leading '+': matching documents must contain the word
+        bool is_required;
         bool is_stop;
+        // Marked with a trailing '*': data is a prefix, never a stop word
+        bool is_prefix;
     };
 
     QueryWord ParseQueryWord(string_view text) const;
 
+    // Live terms starting with prefix, sorted by id; all of them for exclusions
+    vector<TermId> ExpandPrefix(string_view prefix, bool is_excluded) const;
+
+    // Words absent from the index are dropped while parsing
     struct Query {
-        vector<string_view> plus_words;
-        vector<string_view> minus_words;
+        vector<TermId> plus_words;
+        vector<TermId> minus_words;
+        // Also among the plus words, which score as usual
+        vector<TermId> required_words;
+        // No document can match then
+        bool has_absent_required_word = false;
     };
 
     const set<string, less<>> stop_words_;
@@ -116,14 +353,213 @@ private:
 
     Query ParseQuery(bool isErasedDuplicates, string_view text) const;
 
-    // Existence required
-    double ComputeWordInverseDocumentFreq(const string_view word) const;
+    uint32_t GetDocumentOrdinal(int document_id) const;
+
+    // Cached per term and recomputed once the statistics epoch has moved on
+    double ComputeWordInverseDocumentFreq(TermId term_id) const;
+
+    uint32_t GetStatisticsDocumentFreq(TermId term_id) const;
+
+    void UpdateTermStatistics(TermStatistics& statistics) const;
+
+    // Takes the (impact, ordinal) pairs of all postings of a term
+    static ImpactOrder MakeImpactOrder(vector<pair<uint16_t, uint32_t>> postings);
+
+    ImpactOrder MakeImpactOrder(TermId term_id) const;
+
+    void UpdateImpactOrder(TermId term_id, uint32_t ordinal, uint16_t impact);
+
+    // Number of postings over all status partitions, removed documents included
+    size_t GetPostingCount(TermId term_id) const;
+
+    void UpdateTermBitmap(TermId term_id, uint32_t ordinal);
+
+    bool HasTerm(uint32_t ordinal, DocumentStatus status, TermId term_id) const;
+
+    // Term count of the document, 0 if it does not contain the term
+    uint32_t GetDocumentTermCount(uint32_t ordinal, TermId term_id) const;
+
+    void OnCollectionChanged();
+
+    void CompactIfNeeded();
+
+    // Tombstones the documents and returns their ordinals
+    vector<uint32_t> MarkRemoved(span<const int> document_ids);
+
+    static bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
+    static double ComputeTermFreq(uint32_t term_count, uint32_t document_length);
 
+    template <typename Policy>
+    static void SelectTopDocuments(Policy policy, vector<Document>& documents, int top_count, int offset);
+
+    static void SelectTopDocuments(QueryMode, vector<Document>& documents, int top_count, int offset);
+
+    vector<string_view> GetSortedWords(const vector<TermId>& term_ids) const;
+
+    // Parallel queries do not split the ordinals into shards smaller than this
+    inline static constexpr size_t MIN_SHARD_SIZE = 4096;
+    // Ordinals per range in QueryMode::BLOCKED: the accumulator slots of a range
+    // take 12 bytes each, under a megabyte in all
+    inline static constexpr size_t ACCUMULATOR_BLOCK_SIZE = 65536;
+    // QueryMode::QUANTIZED scores with cursors instead when the postings of the
+    // query number fewer than this share of the ordinals
+    inline static constexpr size_t MIN_QUANTIZED_POSTING_SHARE = 16;
+
+    // Cursors over the postings of a query, positioned by increasing ordinal ranges.
+    // Minus words with a term bitmap are excluded through it instead.
+    struct QueryCursors {
+        vector<PostingList::Cursor> plus_cursors;
+        vector<double> term_weights;
+        vector<PostingList::Cursor> minus_cursors;
+        vector<const RoaringBitmap*> minus_bitmaps;
+    };
+
+    // Status partitions [first, last) a query has to read
+    struct StatusPartitions {
+        size_t first = 0;
+        size_t last = STATUS_COUNT;
+    };
+
+    template <typename DocumentPredicate>
+    static StatusPartitions GetStatusPartitions(const DocumentPredicate& document_predicate);
+
+    // Excludes every document containing a minus word, from an accumulator reset
+    // to all ordinals
+    void ExcludeMinusWords(ScoreAccumulator& accumulator, const Query& query, StatusPartitions statuses) const;
+
+    // One cursor per term and status partition; a document sits in one partition
+    // of every term, so scoring the partitions as separate terms sums the same
+    template <typename Scorer>
+    QueryCursors OpenQueryCursors(const Query& query, StatusPartitions statuses) const;
+
+    // Scores the ordinals in [first_ordinal, last_ordinal) with the accumulator of
+    // the current thread and appends the matches to documents
+    template <typename Scorer, typename DocumentPredicate>
+    void ScoreOrdinalRange(const Scorer& scorer, QueryCursors& cursors, DocumentPredicate document_predicate,
+                           uint32_t first_ordinal, uint32_t last_ordinal, vector<Document>& documents) const;
+
+    static void KeepMostRelevant(vector<Document>& documents, size_t result_count);
+
+    // Whether a live document passes the predicate, evaluated on first sight and
+    // remembered in the accumulator for the rest of the query
     template <typename DocumentPredicate>
-    vector<Document> FindAllDocuments(execution::sequenced_policy, const Query &query, DocumentPredicate document_predicate) const;
+    bool IsCandidate(ScoreAccumulator& accumulator, DocumentPredicate& document_predicate,
+                     uint32_t ordinal, uint32_t first_ordinal) const;
+
+    template <typename Scorer>
+    Scorer MakeScorer() const;
+
+    template <typename Scorer>
+    double ComputeTermWeight(TermId term_id) const;
+
+    // Each overload returns at least the result_count most relevant matches
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindAllDocuments(execution::sequenced_policy, const Query &query, DocumentPredicate document_predicate,
+                                      size_t result_count) const;
+
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindAllDocuments(execution::parallel_policy, const Query &query, DocumentPredicate document_predicate,
+                                      size_t result_count) const;
 
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindAllDocuments(QueryMode mode, const Query &query, DocumentPredicate document_predicate,
+                                      size_t result_count) const;
+
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindExhaustiveDocuments(const Query &query, DocumentPredicate document_predicate) const;
+
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindMaxScoreDocuments(const Query &query, DocumentPredicate document_predicate,
+                                           size_t result_count) const;
+
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindQuantizedDocuments(const Query &query, DocumentPredicate document_predicate,
+                                            size_t result_count) const;
+
+    // Ordinals of the documents holding every one of the terms, from the status
+    // partitions given, in no particular order. Removed documents are included.
+    vector<uint32_t> IntersectTerms(const vector<TermId>& term_ids, StatusPartitions statuses) const;
+
+    // Documents holding any of the terms; like EvaluateQueryPlan, may hold
+    // documents of other statuses and removed ones
+    RoaringBitmap UniteTerms(const vector<TermId>& term_ids, StatusPartitions statuses) const;
+
+    // Queries with required words score only the intersection, whatever the
+    // policy or mode
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindConjunctiveDocuments(const Query &query, DocumentPredicate document_predicate) const;
+
+    // A boolean query resolved against the index: stop words are dropped, words
+    // without live documents become EMPTY and the children of AND are ordered
+    // by their estimated number of matches, smallest first
+    struct QueryPlanNode {
+        enum class Kind : uint8_t {
+            TERM,
+            EMPTY,
+            AND,
+            OR,
+            NOT,
+            PHRASE,
+        };
+
+        Kind kind = Kind::EMPTY;
+        TermId term_id = TermDictionary::NOT_FOUND;
+        size_t estimated_size = 0;
+        vector<QueryPlanNode> children;
+        // For PHRASE: the position of each TERM child within the phrase
+        vector<uint32_t> phrase_offsets;
+    };
+
+    // A node without children, the term and size left out where they do not apply
+    static QueryPlanNode MakePlanNode(QueryPlanNode::Kind kind, TermId term_id = TermDictionary::NOT_FOUND,
+                                      size_t estimated_size = 0);
+
+    // Nothing when the query holds only stop words. Under an odd number of NOT
+    // the node excludes documents.
+    optional<QueryPlanNode> CompileBooleanQuery(const BooleanQueryNode& node, bool is_excluded = false) const;
+
+    // Only the given status partitions are read where that saves work, so the
+    // result may still hold documents of other statuses, and removed ones
+    RoaringBitmap EvaluateQueryPlan(const QueryPlanNode& node, StatusPartitions statuses) const;
+
+    // Live documents of the statuses, the complement base of NOT
+    RoaringBitmap GetStatusDocuments(StatusPartitions statuses) const;
+
+    bool MatchesQueryPlan(const QueryPlanNode& node, uint32_t ordinal) const;
+
+    // Intersects the position lists of the phrase, starting from its word
+    // that occurs least often in the document
+    bool MatchesPhrase(const QueryPlanNode& node, uint32_t ordinal) const;
+
+    // word_term_ids holds the terms of the words that are not stop words, in document order
+    void EncodePositions(string_view document, const vector<TermId>& word_term_ids,
+                         DocumentTerms& document_terms) const;
+
+    // Empty unless the document was added with the positional index enabled
+    vector<uint32_t> GetTermPositions(uint32_t ordinal, TermId term_id) const;
+
+    // Terms outside NOT, the ones relevance is computed from
+    static void CollectScoredTerms(const QueryPlanNode& node, vector<TermId>& term_ids);
+
+    vector<TermId> MatchBooleanQuery(const BooleanQueryNode& boolean_query, uint32_t ordinal) const;
+
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindBooleanDocuments(const BooleanQueryNode& boolean_query,
+                                          DocumentPredicate document_predicate) const;
+
+    bool CanUseImpactOrders(const Query& query) const;
+
+    // Exact TF-IDF top documents by the threshold algorithm over the impact
+    // orders, stopping once unseen documents cannot reach the top. Nothing if
+    // the orders run out first.
     template <typename DocumentPredicate>
-    vector<Document> FindAllDocuments(execution::parallel_policy, const Query &query, DocumentPredicate document_predicate) const;
+    optional<vector<Document>> FindImpactOrderedDocuments(const Query &query, DocumentPredicate document_predicate,
+                                                size_t result_count) const;
+
+    template <typename Scorer, typename DocumentPredicate>
+    vector<Document> FindBlockedDocuments(const Query &query, DocumentPredicate document_predicate,
+                                          size_t result_count) const;
 };
 
 template <typename StringContainer>
@@ -134,111 +570,686 @@ SearchServer::SearchServer(const StringContainer& stop_words)
     }
 }
 
-template <typename DocumentPredicate, typename Policy>
+inline bool SearchServer::IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    const double bias = 1e-6;
+    if (abs(lhs.relevance - rhs.relevance) < bias) {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+inline double SearchServer::ComputeTermFreq(uint32_t term_count, uint32_t document_length) {
+    return static_cast<double>(term_count) / document_length;
+}
+
+template <typename Scorer>
+Scorer SearchServer::MakeScorer() const {
+    return Scorer(statistics_document_count_ == 0
+                  ? 0.0 : static_cast<double>(statistics_total_length_) / statistics_document_count_);
+}
+
+template <typename Scorer>
+double SearchServer::ComputeTermWeight(TermId term_id) const {
+    // TF-IDF weights are cached with the term statistics
+    if constexpr (is_same_v<Scorer, TfIdf>) {
+        return ComputeWordInverseDocumentFreq(term_id);
+    }
+    else {
+        return Scorer::ComputeTermWeight(statistics_document_count_, GetStatisticsDocumentFreq(term_id));
+    }
+}
+
+template <typename Scorer, typename DocumentPredicate, typename Policy>
 vector<Document> SearchServer::FindTopDocuments(Policy policy, string_view raw_query,
                                                 DocumentPredicate document_predicate) const {
-    const double bias = 1e-6;
-    const Query query = ParseQuery(raw_query);
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
-
-    sort(policy, matched_documents.begin(), matched_documents.end(),
-         [bias](const Document& lhs, const Document& rhs) {
-             if (abs(lhs.relevance - rhs.relevance) < bias) {
-                 return lhs.rating > rhs.rating;
-             }
-             return lhs.relevance > rhs.relevance;
-         });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    return FindTopDocuments<Scorer>(policy, raw_query, document_predicate, MAX_RESULT_DOCUMENT_COUNT);
+}
+
+template <typename Scorer, typename DocumentPredicate, typename Policy>
+vector<Document> SearchServer::FindTopDocuments(Policy policy, string_view raw_query, DocumentPredicate document_predicate,
+                                                int top_count, int offset) const {
+    if (top_count < 0 || offset < 0) {
+        throw invalid_argument("Denied result count");
+    }
+    vector<Document> matched_documents;
+    if (const optional<BooleanQueryNode> boolean_query = ParseBooleanQuery(raw_query)) {
+        matched_documents = FindBooleanDocuments<Scorer>(*boolean_query, document_predicate);
     }
+    else {
+        const Query query = ParseQuery(raw_query);
+        matched_documents = query.required_words.empty() && !query.has_absent_required_word
+                ? FindAllDocuments<Scorer>(policy, query, document_predicate, static_cast<size_t>(offset) + top_count)
+                : FindConjunctiveDocuments<Scorer>(query, document_predicate);
+    }
+    SelectTopDocuments(policy, matched_documents, top_count, offset);
     return matched_documents;
 }
 
-template <typename DocumentPredicate>
+template <typename Policy>
+void SearchServer::SelectTopDocuments(Policy policy, vector<Document>& documents, int top_count, int offset) {
+    // Only the first offset + top_count places get ordered: O(n log k) instead of a full sort
+    const size_t result_count = static_cast<size_t>(offset) + top_count;
+    if (documents.size() > result_count) {
+        partial_sort(policy, documents.begin(), documents.begin() + result_count, documents.end(), IsMoreRelevant);
+        documents.resize(result_count);
+    }
+    else {
+        sort(policy, documents.begin(), documents.end(), IsMoreRelevant);
+    }
+    documents.erase(documents.begin(), documents.begin() + min(documents.size(), static_cast<size_t>(offset)));
+}
+
+inline void SearchServer::SelectTopDocuments(QueryMode, vector<Document>& documents, int top_count, int offset) {
+    SelectTopDocuments(execution::seq, documents, top_count, offset);
+}
+
+template <typename Scorer, typename DocumentPredicate>
 vector<Document> SearchServer::FindAllDocuments(execution::sequenced_policy, const Query &query,
-                                                DocumentPredicate document_predicate) const {
-    map<int, double> document_to_relevance;
-    for (const auto& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+                                                DocumentPredicate document_predicate,
+                                                [[maybe_unused]] size_t result_count) const {
+    if constexpr (is_same_v<Scorer, TfIdf>) {
+        if (CanUseImpactOrders(query)) {
+            if (optional<vector<Document>> documents = FindImpactOrderedDocuments(query, document_predicate,
+                                                                                  result_count)) {
+                return move(*documents);
             }
         }
     }
+    return FindExhaustiveDocuments<Scorer>(query, document_predicate);
+}
+
+template <typename Scorer, typename DocumentPredicate>
+vector<Document> SearchServer::FindExhaustiveDocuments(const Query &query, DocumentPredicate document_predicate) const {
+    const Scorer scorer = MakeScorer<Scorer>();
+    ScoreAccumulator& accumulator = ScoreAccumulator::ForCurrentThread();
+    accumulator.Reset(document_ids_.size());
+    const StatusPartitions statuses = GetStatusPartitions(document_predicate);
+    ExcludeMinusWords(accumulator, query, statuses);
 
-    for (const auto& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+    for (const TermId term_id : query.plus_words) {
+        if (term_statistics_[term_id].document_freq == 0) {
             continue;
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+        const double term_weight = ComputeTermWeight<Scorer>(term_id);
+        for (size_t status = statuses.first; status < statuses.last; ++status) {
+            for (PostingList::Cursor cursor(postings_[term_id][status]); cursor.GetOrdinal() != PostingList::END_ORDINAL;
+                 cursor.Next()) {
+                const uint32_t ordinal = cursor.GetOrdinal();
+                if (accumulator.IsExcluded(ordinal) || tombstones_[ordinal]
+                    || !IsCandidate(accumulator, document_predicate, ordinal, 0)) {
+                    continue;
+                }
+                accumulator.Add(ordinal, scorer.ComputeScore(cursor.GetTermCount(), document_lengths_[ordinal], term_weight));
+            }
         }
     }
 
     vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
+    matched_documents.reserve(accumulator.GetTouched().size());
+    for (const uint32_t ordinal : accumulator.GetTouched()) {
         matched_documents.push_back(
-                {document_id, relevance, documents_.at(document_id).rating});
+                {document_ids_[ordinal], accumulator.GetScore(ordinal), document_ratings_[ordinal]});
+    }
+    return matched_documents;
+}
+
+template <typename Scorer, typename DocumentPredicate>
+vector<Document> SearchServer::FindAllDocuments(execution::parallel_policy, const Query &query, DocumentPredicate document_predicate,
+                                                size_t result_count) const {
+    // Every shard owns a contiguous range of ordinals and is scored without locks
+    // into the accumulator of the thread that runs it
+    const size_t ordinal_count = document_ids_.size();
+    const size_t shard_count = max<size_t>(1, min<size_t>(std::thread::hardware_concurrency(),
+                                                          ordinal_count / MIN_SHARD_SIZE));
+    const Scorer scorer = MakeScorer<Scorer>();
+    vector<vector<Document>> shard_documents(shard_count);
+    vector<size_t> shards(shard_count);
+    iota(shards.begin(), shards.end(), 0);
+    for_each(execution::par, shards.begin(), shards.end(), [&](const size_t shard) {
+        const auto first_ordinal = static_cast<uint32_t>(ordinal_count * shard / shard_count);
+        const auto last_ordinal = static_cast<uint32_t>(ordinal_count * (shard + 1) / shard_count);
+        QueryCursors cursors = OpenQueryCursors<Scorer>(query, GetStatusPartitions(document_predicate));
+        vector<Document>& documents = shard_documents[shard];
+        ScoreOrdinalRange(scorer, cursors, document_predicate, first_ordinal, last_ordinal, documents);
+        KeepMostRelevant(documents, result_count);
+    });
+
+    vector<Document> matched_documents;
+    for (const auto& documents : shard_documents) {
+        matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
     }
     return matched_documents;
 }
 
 template <typename DocumentPredicate>
-vector<Document> SearchServer::FindAllDocuments(execution::parallel_policy, const Query &query, DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(std::thread::hardware_concurrency());
-    const auto& plus_words = query.plus_words;
-    for_each(execution::par, plus_words.begin(), plus_words.end(), [&](const auto& word) {
-        if (word_to_document_freqs_.count(word) != 0) {
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-            for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
-                }
+SearchServer::StatusPartitions SearchServer::GetStatusPartitions(
+        [[maybe_unused]] const DocumentPredicate& document_predicate) {
+    if constexpr (is_same_v<DocumentPredicate, StatusPredicate>) {
+        const auto status = static_cast<size_t>(document_predicate.status);
+        return {status, status + 1};
+    }
+    else {
+        return {};
+    }
+}
+
+template <typename Scorer>
+SearchServer::QueryCursors SearchServer::OpenQueryCursors(const Query& query, StatusPartitions statuses) const {
+    QueryCursors cursors;
+    for (const TermId term_id : query.plus_words) {
+        if (term_statistics_[term_id].document_freq == 0) {
+            continue;
+        }
+        const double term_weight = ComputeTermWeight<Scorer>(term_id);
+        for (size_t status = statuses.first; status < statuses.last; ++status) {
+            if (!postings_[term_id][status].empty()) {
+                cursors.plus_cursors.emplace_back(postings_[term_id][status]);
+                cursors.term_weights.push_back(term_weight);
             }
         }
-    });
-    auto doc_res = document_to_relevance.BuildOrdinaryMap();
-    const auto& minus_words = query.minus_words;
-    std::mutex m;
-    for_each(execution::par, minus_words.begin(), minus_words.end(), [&](const auto& word) {
-        if (word_to_document_freqs_.count(word) != 0) {
-            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                lock_guard guard(m);
-                doc_res.erase(document_id);
+    }
+    for (const TermId term_id : query.minus_words) {
+        if (!term_bitmaps_[term_id].empty()) {
+            cursors.minus_bitmaps.push_back(&term_bitmaps_[term_id]);
+            continue;
+        }
+        for (size_t status = statuses.first; status < statuses.last; ++status) {
+            if (!postings_[term_id][status].empty()) {
+                cursors.minus_cursors.emplace_back(postings_[term_id][status]);
             }
         }
-    });
+    }
+    return cursors;
+}
+
+template <typename Scorer, typename DocumentPredicate>
+void SearchServer::ScoreOrdinalRange(const Scorer& scorer, QueryCursors& cursors, DocumentPredicate document_predicate,
+                                     uint32_t first_ordinal, uint32_t last_ordinal, vector<Document>& documents) const {
+    ScoreAccumulator& accumulator = ScoreAccumulator::ForCurrentThread();
+    accumulator.Reset(last_ordinal - first_ordinal);
+    for (PostingList::Cursor& cursor : cursors.minus_cursors) {
+        for (cursor.SkipTo(first_ordinal); cursor.GetOrdinal() < last_ordinal; cursor.Next()) {
+            accumulator.Exclude(cursor.GetOrdinal() - first_ordinal);
+        }
+    }
+    for (const RoaringBitmap* bitmap : cursors.minus_bitmaps) {
+        bitmap->OrInto(first_ordinal, last_ordinal - first_ordinal,
+                       accumulator.GetExcludedWords(last_ordinal - first_ordinal));
+    }
+
+    for (size_t i = 0; i < cursors.plus_cursors.size(); ++i) {
+        PostingList::Cursor& cursor = cursors.plus_cursors[i];
+        const double term_weight = cursors.term_weights[i];
+        for (cursor.SkipTo(first_ordinal); cursor.GetOrdinal() < last_ordinal; cursor.Next()) {
+            const uint32_t ordinal = cursor.GetOrdinal();
+            if (accumulator.IsExcluded(ordinal - first_ordinal) || tombstones_[ordinal]
+                || !IsCandidate(accumulator, document_predicate, ordinal, first_ordinal)) {
+                continue;
+            }
+            accumulator.Add(ordinal - first_ordinal,
+                            scorer.ComputeScore(cursor.GetTermCount(), document_lengths_[ordinal], term_weight));
+        }
+    }
+
+    for (const uint32_t local_ordinal : accumulator.GetTouched()) {
+        const uint32_t ordinal = first_ordinal + local_ordinal;
+        documents.emplace_back(document_ids_[ordinal], accumulator.GetScore(local_ordinal), document_ratings_[ordinal]);
+    }
+}
+
+template <typename DocumentPredicate>
+bool SearchServer::IsCandidate(ScoreAccumulator& accumulator, DocumentPredicate& document_predicate,
+                               uint32_t ordinal, uint32_t first_ordinal) const {
+    // Queries with a status predicate read only the postings of that status
+    if constexpr (is_same_v<DocumentPredicate, StatusPredicate>) {
+        return true;
+    }
+    if (accumulator.IsAccepted(ordinal - first_ordinal)) {
+        return true;
+    }
+    if (document_predicate(document_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+        accumulator.Accept(ordinal - first_ordinal);
+        return true;
+    }
+    accumulator.Exclude(ordinal - first_ordinal);
+    return false;
+}
+
+inline void SearchServer::KeepMostRelevant(vector<Document>& documents, size_t result_count) {
+    if (documents.size() > result_count) {
+        nth_element(documents.begin(), documents.begin() + result_count, documents.end(), IsMoreRelevant);
+        documents.resize(result_count);
+    }
+}
+
+template <typename Scorer, typename DocumentPredicate>
+vector<Document> SearchServer::FindConjunctiveDocuments(const Query &query, DocumentPredicate document_predicate) const {
+    if (query.has_absent_required_word) {
+        return {};
+    }
+    const Scorer scorer = MakeScorer<Scorer>();
+    vector<pair<TermId, double>> terms;
+    for (const TermId term_id : query.plus_words) {
+        if (term_statistics_[term_id].document_freq != 0) {
+            terms.emplace_back(term_id, ComputeTermWeight<Scorer>(term_id));
+        }
+    }
+    // Candidates come in no particular order, so they are scored through the forward index
     vector<Document> matched_documents;
-    matched_documents.reserve(doc_res.size());
-    for_each(execution::par, doc_res.begin(), doc_res.end(), [&](const std::pair<int, double>& pair) {
-        matched_documents.emplace_back(pair.first, pair.second, documents_.at(pair.first).rating);
+    for (const uint32_t ordinal : IntersectTerms(query.required_words, GetStatusPartitions(document_predicate))) {
+        if (tombstones_[ordinal]
+            || any_of(query.minus_words.begin(), query.minus_words.end(), [this, ordinal](const TermId term_id) {
+                return GetDocumentTermCount(ordinal, term_id) != 0;
+            })
+            || !document_predicate(document_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+            continue;
+        }
+        double relevance = 0.0;
+        for (const auto& [term_id, term_weight] : terms) {
+            const uint32_t term_count = GetDocumentTermCount(ordinal, term_id);
+            if (term_count != 0) {
+                relevance += scorer.ComputeScore(term_count, document_lengths_[ordinal], term_weight);
+            }
+        }
+        matched_documents.emplace_back(document_ids_[ordinal], relevance, document_ratings_[ordinal]);
+    }
+    return matched_documents;
+}
+
+template <typename Scorer, typename DocumentPredicate>
+vector<Document> SearchServer::FindBooleanDocuments(const BooleanQueryNode& boolean_query,
+                                                    DocumentPredicate document_predicate) const {
+    const optional<QueryPlanNode> plan = CompileBooleanQuery(boolean_query);
+    if (!plan) {
+        return {};
+    }
+    const Scorer scorer = MakeScorer<Scorer>();
+    vector<TermId> term_ids;
+    CollectScoredTerms(*plan, term_ids);
+    sort(term_ids.begin(), term_ids.end());
+    term_ids.erase(unique(term_ids.begin(), term_ids.end()), term_ids.end());
+    vector<double> term_weights;
+    for (const TermId term_id : term_ids) {
+        term_weights.push_back(ComputeTermWeight<Scorer>(term_id));
+    }
+
+    vector<Document> matched_documents;
+    EvaluateQueryPlan(*plan, GetStatusPartitions(document_predicate)).ForEach([&](const uint32_t ordinal) {
+        if (tombstones_[ordinal]
+            || !document_predicate(document_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+            return;
+        }
+        double relevance = 0.0;
+        for (size_t i = 0; i < term_ids.size(); ++i) {
+            const uint32_t term_count = GetDocumentTermCount(ordinal, term_ids[i]);
+            if (term_count != 0) {
+                relevance += scorer.ComputeScore(term_count, document_lengths_[ordinal], term_weights[i]);
+            }
+        }
+        matched_documents.emplace_back(document_ids_[ordinal], relevance, document_ratings_[ordinal]);
     });
     return matched_documents;
 }
 
-template <typename PolicyExec>
+template <typename DocumentPredicate>
+optional<vector<Document>> SearchServer::FindImpactOrderedDocuments(const Query &query, DocumentPredicate document_predicate,
+                                                                    size_t result_count) const {
+    const double bias = 1e-6;
+    const TfIdf scorer = MakeScorer<TfIdf>();
+    struct TermOrder {
+        TermId term_id;
+        double term_weight;
+        const ImpactOrder* order;
+        size_t position;
+    };
+    vector<TermOrder> terms;
+    for (const TermId term_id : query.plus_words) {
+        if (term_statistics_[term_id].document_freq != 0) {
+            terms.push_back({term_id, ComputeTermWeight<TfIdf>(term_id), &impact_orders_[term_id], 0});
+        }
+    }
+
+    // Documents are scored in full through the forward index when first
+    // seen; the exclusion bitmap marks the seen ones
+    ScoreAccumulator& accumulator = ScoreAccumulator::ForCurrentThread();
+    accumulator.Reset(document_ids_.size());
+    vector<Document> matched_documents;
+    priority_queue<double, vector<double>, greater<>> top_relevances;
+    const auto visit = [&](const uint32_t ordinal) {
+        if (accumulator.IsExcluded(ordinal)) {
+            return;
+        }
+        accumulator.Exclude(ordinal);
+        if (tombstones_[ordinal]) {
+            return;
+        }
+        for (const TermId term_id : query.minus_words) {
+            if (GetDocumentTermCount(ordinal, term_id) != 0) {
+                return;
+            }
+        }
+        if (!document_predicate(document_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+            return;
+        }
+        double relevance = 0.0;
+        for (const TermOrder& term : terms) {
+            const uint32_t term_count = GetDocumentTermCount(ordinal, term.term_id);
+            if (term_count != 0) {
+                relevance += scorer.ComputeScore(term_count, document_lengths_[ordinal], term.term_weight);
+            }
+        }
+        matched_documents.emplace_back(document_ids_[ordinal], relevance, document_ratings_[ordinal]);
+        top_relevances.push(relevance);
+        if (top_relevances.size() > result_count) {
+            top_relevances.pop();
+        }
+    };
+    // Impacts round the term frequency to a multiple of 1 / MAX_IMPACT
+    const auto get_max_term_freq = [](const uint16_t impact) {
+        return impact == 0 ? 0.0 : (impact + 0.5) / TfIdf::MAX_IMPACT;
+    };
+
+    // A document not seen yet scores at most the term weights times the
+    // frequencies of the current impacts, or of the remaining ones past the
+    // end of an order
+    while (true) {
+        double unseen_bound = 0.0;
+        TermOrder* next_term = nullptr;
+        double next_score = -1.0;
+        for (TermOrder& term : terms) {
+            if (term.position == term.order->ordinals.size()) {
+                unseen_bound += get_max_term_freq(term.order->remaining_impact) * term.term_weight;
+                continue;
+            }
+            const double score = get_max_term_freq(term.order->impacts[term.position]) * term.term_weight;
+            unseen_bound += score;
+            if (score > next_score) {
+                next_score = score;
+                next_term = &term;
+            }
+        }
+        if (top_relevances.size() == result_count
+            && (result_count == 0 || unseen_bound < top_relevances.top() - bias)) {
+            return matched_documents;
+        }
+        if (next_term == nullptr) {
+            return nullopt;
+        }
+        visit(next_term->order->ordinals[next_term->position]);
+        ++next_term->position;
+    }
+}
+
+template <typename Scorer, typename DocumentPredicate>
+vector<Document> SearchServer::FindBlockedDocuments(const Query &query, DocumentPredicate document_predicate,
+                                                    size_t result_count) const {
+    // The cursors move forward from range to range, skipping to each range
+    // through the block skip data, and the matches of every range are cut
+    // down to the best result_count right away
+    const Scorer scorer = MakeScorer<Scorer>();
+    QueryCursors cursors = OpenQueryCursors<Scorer>(query, GetStatusPartitions(document_predicate));
+    vector<Document> matched_documents;
+    const size_t ordinal_count = document_ids_.size();
+    for (size_t first_ordinal = 0; first_ordinal < ordinal_count; first_ordinal += ACCUMULATOR_BLOCK_SIZE) {
+        const size_t last_ordinal = min(ordinal_count, first_ordinal + ACCUMULATOR_BLOCK_SIZE);
+        ScoreOrdinalRange(scorer, cursors, document_predicate, static_cast<uint32_t>(first_ordinal),
+                          static_cast<uint32_t>(last_ordinal), matched_documents);
+        KeepMostRelevant(matched_documents, result_count);
+    }
+    return matched_documents;
+}
+
+template <typename Scorer, typename DocumentPredicate>
+vector<Document> SearchServer::FindAllDocuments(QueryMode mode, const Query &query, DocumentPredicate document_predicate,
+                                                size_t result_count) const {
+    switch (mode) {
+        case QueryMode::MAX_SCORE:
+            return FindMaxScoreDocuments<Scorer>(query, document_predicate, result_count);
+        case QueryMode::QUANTIZED:
+            return FindQuantizedDocuments<Scorer>(query, document_predicate, result_count);
+        case QueryMode::BLOCKED:
+            return FindBlockedDocuments<Scorer>(query, document_predicate, result_count);
+        default:
+            return FindExhaustiveDocuments<Scorer>(query, document_predicate);
+    }
+}
+
+template <typename Scorer, typename DocumentPredicate>
+vector<Document> SearchServer::FindMaxScoreDocuments(const Query &query, DocumentPredicate document_predicate,
+                                                     size_t result_count) const {
+    const double bias = 1e-6;
+    const Scorer scorer = MakeScorer<Scorer>();
+    struct TermCursor {
+        PostingList::Cursor cursor;
+        double term_weight;
+        double max_score;
+    };
+    // Every status partition is a term of its own, with its own bound
+    const StatusPartitions statuses = GetStatusPartitions(document_predicate);
+    vector<TermCursor> terms;
+    for (const TermId term_id : query.plus_words) {
+        if (term_statistics_[term_id].document_freq == 0) {
+            continue;
+        }
+        const double term_weight = ComputeTermWeight<Scorer>(term_id);
+        for (size_t status = statuses.first; status < statuses.last; ++status) {
+            const PostingList& postings = postings_[term_id][status];
+            if (!postings.empty()) {
+                terms.push_back({PostingList::Cursor(postings), term_weight,
+                                 scorer.ComputeMaxScore(postings.GetBound(), term_weight)});
+            }
+        }
+    }
+    vector<PostingList::Cursor> minus_cursors;
+    vector<const RoaringBitmap*> minus_bitmaps;
+    for (const TermId term_id : query.minus_words) {
+        if (!term_bitmaps_[term_id].empty()) {
+            minus_bitmaps.push_back(&term_bitmaps_[term_id]);
+            continue;
+        }
+        for (size_t status = statuses.first; status < statuses.last; ++status) {
+            minus_cursors.emplace_back(postings_[term_id][status]);
+        }
+    }
+    if (terms.empty() || result_count == 0) {
+        return {};
+    }
+
+    // max_score_sums[i] bounds the score of a document matching only terms[0..i]
+    sort(terms.begin(), terms.end(), [](const TermCursor& lhs, const TermCursor& rhs) {
+        return lhs.max_score < rhs.max_score;
+    });
+    vector<double> max_score_sums;
+    double max_score_sum = 0.0;
+    for (const TermCursor& term : terms) {
+        max_score_sum += term.max_score;
+        max_score_sums.push_back(max_score_sum);
+    }
+
+    // Heap of the best documents so far, the least relevant one on top
+    vector<Document> top_documents;
+    double threshold = -numeric_limits<double>::infinity();
+    // Terms before first_essential alone cannot lift a document over the threshold,
+    // so only the essential ones supply candidates
+    size_t first_essential = 0;
+    while (true) {
+        while (first_essential < terms.size() && max_score_sums[first_essential] < threshold - bias) {
+            ++first_essential;
+        }
+        if (first_essential == terms.size()) {
+            break;
+        }
+        uint32_t ordinal = PostingList::END_ORDINAL;
+        for (size_t i = first_essential; i < terms.size(); ++i) {
+            ordinal = min(ordinal, terms[i].cursor.GetOrdinal());
+        }
+        if (ordinal == PostingList::END_ORDINAL) {
+            break;
+        }
+
+        double score = 0.0;
+        for (size_t i = first_essential; i < terms.size(); ++i) {
+            TermCursor& term = terms[i];
+            if (term.cursor.GetOrdinal() == ordinal) {
+                score += scorer.ComputeScore(term.cursor.GetTermCount(), document_lengths_[ordinal], term.term_weight);
+                term.cursor.Next();
+            }
+        }
+        if (first_essential > 0) {
+            if (score + max_score_sums[first_essential - 1] < threshold - bias) {
+                continue;
+            }
+            double block_max_score = score;
+            for (size_t i = 0; i < first_essential; ++i) {
+                block_max_score += scorer.ComputeMaxScore(terms[i].cursor.GetBlockBound(ordinal), terms[i].term_weight);
+            }
+            if (block_max_score < threshold - bias) {
+                continue;
+            }
+        }
+
+        if (tombstones_[ordinal]) {
+            continue;
+        }
+        if (!document_predicate(document_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+            continue;
+        }
+        bool is_excluded = false;
+        for (auto& minus_cursor : minus_cursors) {
+            minus_cursor.SkipTo(ordinal);
+            is_excluded = is_excluded || minus_cursor.GetOrdinal() == ordinal;
+        }
+        for (const RoaringBitmap* bitmap : minus_bitmaps) {
+            is_excluded = is_excluded || bitmap->Contains(ordinal);
+        }
+        if (is_excluded) {
+            continue;
+        }
+
+        bool is_pruned = false;
+        for (size_t i = first_essential; i-- > 0; ) {
+            if (score + max_score_sums[i] < threshold - bias) {
+                is_pruned = true;
+                break;
+            }
+            TermCursor& term = terms[i];
+            term.cursor.SkipTo(ordinal);
+            if (term.cursor.GetOrdinal() == ordinal) {
+                score += scorer.ComputeScore(term.cursor.GetTermCount(), document_lengths_[ordinal], term.term_weight);
+            }
+        }
+        if (is_pruned) {
+            continue;
+        }
+
+        const Document document(document_ids_[ordinal], score, document_ratings_[ordinal]);
+        if (top_documents.size() < result_count) {
+            top_documents.push_back(document);
+            push_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+        }
+        else if (IsMoreRelevant(document, top_documents.front())) {
+            pop_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+            top_documents.back() = document;
+            push_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+        }
+        if (top_documents.size() == result_count) {
+            threshold = top_documents.front().relevance;
+        }
+    }
+    return top_documents;
+}
+
+template <typename Scorer, typename DocumentPredicate>
+vector<Document> SearchServer::FindQuantizedDocuments(const Query &query, DocumentPredicate document_predicate,
+                                                      size_t result_count) const {
+    // Impacts are TF-IDF term frequencies, other scorers are evaluated exactly
+    if constexpr (!is_same_v<Scorer, TfIdf>) {
+        return FindAllDocuments<Scorer>(execution::seq, query, document_predicate, result_count);
+    }
+    else {
+        if (!are_impacts_enabled_) {
+            throw invalid_argument("Quantized impacts are disabled");
+        }
+        vector<pair<TermId, double>> terms;
+        double inverse_document_freq_sum = 0.0;
+        size_t posting_count = 0;
+        for (const TermId term_id : query.plus_words) {
+            if (term_statistics_[term_id].document_freq != 0) {
+                terms.emplace_back(term_id, ComputeWordInverseDocumentFreq(term_id));
+                inverse_document_freq_sum += terms.back().second;
+                posting_count += term_statistics_[term_id].document_freq;
+            }
+        }
+        const size_t ordinal_count = document_ids_.size();
+        // Scattered postings leave most of every written block empty
+        if (posting_count * MIN_QUANTIZED_POSTING_SHARE < ordinal_count) {
+            return FindExhaustiveDocuments<Scorer>(query, document_predicate);
+        }
+        // Rounded weights sum to at most UINT32_MAX / MAX_IMPACT, so the scores cannot overflow
+        const double max_weight_sum = static_cast<double>(UINT32_MAX / TfIdf::MAX_IMPACT) - terms.size();
+        const double weight_scale = inverse_document_freq_sum > 0.0 ? max_weight_sum / inverse_document_freq_sum : 0.0;
+
+        ScoreAccumulator& accumulator = ScoreAccumulator::ForCurrentThread();
+        accumulator.Reset(ordinal_count);
+        uint32_t* const scores = accumulator.ResetQuantizedScores(ordinal_count);
+        const StatusPartitions statuses = GetStatusPartitions(document_predicate);
+        ExcludeMinusWords(accumulator, query, statuses);
+
+        array<uint32_t, PostingList::BLOCK_SIZE> ordinals;
+        for (const auto& [term_id, inverse_document_freq] : terms) {
+            // Weights stay nonzero so that every match keeps a nonzero score
+            const auto weight = max<uint32_t>(1, static_cast<uint32_t>(lround(inverse_document_freq * weight_scale)));
+            for (size_t status = statuses.first; status < statuses.last; ++status) {
+                const PostingList& postings = postings_[term_id][status];
+                const uint16_t* const impacts = impacts_[term_id][status].data();
+                for (size_t block = 0; block < postings.GetBlockCount(); ++block) {
+                    const size_t count = postings.CopyBlockOrdinals(block, ordinals.data());
+                    accumulator.MarkQuantizedBlocks(ordinals.data(), count);
+                    AccumulateImpacts(ordinals.data(), impacts + block * PostingList::BLOCK_SIZE, count, weight, scores);
+                }
+            }
+        }
+
+        // Filters run once per matched document instead of once per posting
+        const double relevance_scale = weight_scale > 0.0 ? 1.0 / (weight_scale * TfIdf::MAX_IMPACT) : 0.0;
+        vector<Document> matched_documents;
+        for (const uint32_t block : accumulator.GetQuantizedBlocks()) {
+            const auto last_ordinal = static_cast<uint32_t>(min<size_t>(ordinal_count, (block + 1) * 64));
+            for (uint32_t ordinal = block * 64; ordinal < last_ordinal; ++ordinal) {
+                if (scores[ordinal] == 0 || tombstones_[ordinal] || accumulator.IsExcluded(ordinal)
+                    || !IsCandidate(accumulator, document_predicate, ordinal, 0)) {
+                    continue;
+                }
+                matched_documents.emplace_back(document_ids_[ordinal], scores[ordinal] * relevance_scale,
+                                               document_ratings_[ordinal]);
+            }
+        }
+        return matched_documents;
+    }
+}
+
+template <typename Scorer, typename PolicyExec>
 vector<Document> SearchServer::FindTopDocuments(PolicyExec policyExec, string_view raw_query) const {
-    return FindTopDocuments(policyExec, raw_query, DocumentStatus::ACTUAL);
+    return FindTopDocuments<Scorer>(policyExec, raw_query, DocumentStatus::ACTUAL);
 }
 
-template<typename PolicyExec>
+template<typename Scorer, typename PolicyExec>
 vector<Document>
 SearchServer::FindTopDocuments(PolicyExec policyExec, string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(policyExec,
-                            raw_query, [status]([[maybe_unused]] int document_id, DocumentStatus document_status,
-                                                [[maybe_unused]] int rating) {
-                return document_status == status;
-            });
+    return FindTopDocuments<Scorer>(policyExec,
+                            raw_query, StatusPredicate{status});
+}
+
+template<typename Scorer, typename PolicyExec>
+vector<Document>
+SearchServer::FindTopDocuments(PolicyExec policyExec, string_view raw_query, DocumentStatus status,
+                               int top_count, int offset) const {
+    return FindTopDocuments<Scorer>(policyExec,
+                            raw_query, StatusPredicate{status}, top_count, offset);
 }
 
 template <typename DocumentPredicate>
 vector<Document> SearchServer::FindTopDocuments(string_view raw_query,
                                   DocumentPredicate document_predicate) const {
     return FindTopDocuments(execution::seq, raw_query, document_predicate);
-}
\ No newline at end of file
+}
@@ -0,0 +1,153 @@
+#include "term_dictionary.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+namespace {
+    const size_t INITIAL_BUCKET_COUNT = 64;
+
+    // Compares like the spellings as long as their first eight bytes differ
+    uint64_t MakeKey(std::string_view term) {
+        uint64_t key = 0;
+        for (size_t i = 0; i < sizeof(key); ++i) {
+            key = key << 8 | (i < term.size() ? static_cast<unsigned char>(term[i]) : 0);
+        }
+        return key;
+    }
+}
+
+TermDictionary::TermDictionary() : buckets_(INITIAL_BUCKET_COUNT) {
+}
+
+TermId TermDictionary::Find(std::string_view term) const {
+    return buckets_[FindBucket(term, std::hash<std::string_view>{}(term))].id;
+}
+
+TermId TermDictionary::Insert(std::string_view term) {
+    const size_t hash = std::hash<std::string_view>{}(term);
+    size_t bucket = FindBucket(term, hash);
+    if (buckets_[bucket].id != NOT_FOUND) {
+        return buckets_[bucket].id;
+    }
+    // Keep the load factor under 1/2 so that probe sequences stay short
+    if ((terms_.size() + 1) * 2 > buckets_.size()) {
+        Rehash(buckets_.size() * 2);
+        bucket = FindBucket(term, hash);
+    }
+    const auto id = static_cast<TermId>(terms_.size());
+    terms_.push_back(spellings_.Store(term));
+    buckets_[bucket] = {hash, id};
+    AddSorted(id);
+    return id;
+}
+
+std::string_view TermDictionary::GetTerm(TermId id) const {
+    return terms_.at(id);
+}
+
+std::vector<TermId> TermDictionary::FindByPrefix(std::string_view prefix, size_t limit) const {
+    std::vector<SortedRange> ranges;
+    size_t match_count = 0;
+    for (const std::vector<SortedId>& run : sorted_runs_) {
+        ranges.push_back(FindPrefixRange(run, prefix));
+        match_count += ranges.back().second - ranges.back().first;
+    }
+    ranges.push_back(FindPrefixRange(recent_ids_, prefix));
+    match_count += ranges.back().second - ranges.back().first;
+
+    std::vector<TermId> found;
+    found.reserve(std::min(match_count, limit));
+    if (match_count <= limit) {
+        for (const auto& [first, last] : ranges) {
+            for (auto it = first; it != last; ++it) {
+                found.push_back(it->id);
+            }
+        }
+        return found;
+    }
+    // There are few runs, so the next id is the least of their heads
+    while (found.size() < limit) {
+        SortedRange* next = nullptr;
+        for (SortedRange& range : ranges) {
+            if (range.first != range.second && (next == nullptr || IsBefore(*range.first, *next->first))) {
+                next = &range;
+            }
+        }
+        found.push_back(next->first->id);
+        ++next->first;
+    }
+    return found;
+}
+
+size_t TermDictionary::size() const {
+    return terms_.size();
+}
+
+size_t TermDictionary::FindBucket(std::string_view term, size_t hash) const {
+    const size_t mask = buckets_.size() - 1;
+    for (size_t bucket = hash & mask; ; bucket = (bucket + 1) & mask) {
+        const Bucket& candidate = buckets_[bucket];
+        if (candidate.id == NOT_FOUND
+            || (candidate.hash == hash && terms_[candidate.id] == term)) {
+            return bucket;
+        }
+    }
+}
+
+void TermDictionary::Rehash(size_t bucket_count) {
+    std::vector<Bucket> old_buckets(bucket_count);
+    old_buckets.swap(buckets_);
+    const size_t mask = buckets_.size() - 1;
+    for (const Bucket& old_bucket : old_buckets) {
+        if (old_bucket.id == NOT_FOUND) {
+            continue;
+        }
+        size_t bucket = old_bucket.hash & mask;
+        while (buckets_[bucket].id != NOT_FOUND) {
+            bucket = (bucket + 1) & mask;
+        }
+        buckets_[bucket] = old_bucket;
+    }
+}
+
+void TermDictionary::AddSorted(TermId id) {
+    const auto is_before = [this](const SortedId& lhs, const SortedId& rhs) {
+        return IsBefore(lhs, rhs);
+    };
+    const SortedId sorted_id{MakeKey(terms_[id]), id};
+    recent_ids_.insert(std::upper_bound(recent_ids_.begin(), recent_ids_.end(), sorted_id, is_before), sorted_id);
+    if (recent_ids_.size() < MAX_RECENT_TERMS) {
+        return;
+    }
+    sorted_runs_.push_back(std::move(recent_ids_));
+    recent_ids_.clear();
+    while (sorted_runs_.size() > 1 && sorted_runs_[sorted_runs_.size() - 2].size() <= sorted_runs_.back().size()) {
+        const std::vector<SortedId>& older = sorted_runs_[sorted_runs_.size() - 2];
+        const std::vector<SortedId>& newer = sorted_runs_.back();
+        std::vector<SortedId> merged;
+        merged.reserve(older.size() + newer.size());
+        std::merge(older.begin(), older.end(), newer.begin(), newer.end(), std::back_inserter(merged), is_before);
+        sorted_runs_.pop_back();
+        sorted_runs_.back() = std::move(merged);
+    }
+}
+
+bool TermDictionary::IsBefore(const SortedId& lhs, const SortedId& rhs) const {
+    if (lhs.key != rhs.key) {
+        return lhs.key < rhs.key;
+    }
+    return terms_[lhs.id] < terms_[rhs.id];
+}
+
+TermDictionary::SortedRange TermDictionary::FindPrefixRange(const std::vector<SortedId>& ids,
+                                                            std::string_view prefix) const {
+    // Terms with the prefix form a range that starts where the prefix would go
+    const auto first = std::lower_bound(ids.begin(), ids.end(), prefix,
+                                        [this](const SortedId& sorted_id, std::string_view text) {
+        return terms_[sorted_id.id] < text;
+    });
+    const auto last = std::partition_point(first, ids.end(), [this, prefix](const SortedId& sorted_id) {
+        return terms_[sorted_id.id].starts_with(prefix);
+    });
+    return {first, last};
+}
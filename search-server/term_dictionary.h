@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "text_arena.h"
+
+using TermId = uint32_t;
+
+// Interns terms: an open-addressing hash table (linear probing) from a term to
+// its dense id. Ids are handed out in insertion order and never reused, so they
+// can index plain vectors of per-term data. The dictionary keeps its own copy
+// of every term, so callers need not keep the text they insert from.
+// For prefix lookups the ids are also kept in spelling order, referring to the
+// same copy of the text: new ids go to a short sorted list, which becomes a run
+// of its own once it fills up. A run is merged with the one before it while
+// that one is not longer, so run lengths at least double from the newest to
+// the oldest and every id is merged a logarithmic number of times. Sorted ids
+// carry the first bytes of their spelling to compare by without reading it.
+class TermDictionary {
+public:
+    inline static constexpr TermId NOT_FOUND = UINT32_MAX;
+
+    TermDictionary();
+
+    TermId Find(std::string_view term) const;
+
+    // Returns the id of term, inserting it first if it is absent
+    TermId Insert(std::string_view term);
+
+    std::string_view GetTerm(TermId id) const;
+
+    // Ids of the terms starting with prefix, in no particular order. If there
+    // are more than limit, the limit first ones in spelling order; only then
+    // are the runs merged, and only up to the limit.
+    std::vector<TermId> FindByPrefix(std::string_view prefix, size_t limit = SIZE_MAX) const;
+
+    size_t size() const;
+
+private:
+    struct Bucket {
+        size_t hash = 0;
+        TermId id = NOT_FOUND;
+    };
+
+    struct SortedId {
+        // The first eight bytes of the spelling, big-endian and zero-padded
+        uint64_t key;
+        TermId id;
+    };
+
+    inline static constexpr size_t MAX_RECENT_TERMS = 1024;
+
+    TextArena spellings_;
+    std::vector<Bucket> buckets_;
+    std::vector<std::string_view> terms_;
+    // Oldest and longest first
+    std::vector<std::vector<SortedId>> sorted_runs_;
+    std::vector<SortedId> recent_ids_;
+
+    size_t FindBucket(std::string_view term, size_t hash) const;
+    void Rehash(size_t bucket_count);
+    void AddSorted(TermId id);
+    bool IsBefore(const SortedId& lhs, const SortedId& rhs) const;
+
+    using SortedRange = std::pair<std::vector<SortedId>::const_iterator, std::vector<SortedId>::const_iterator>;
+    SortedRange FindPrefixRange(const std::vector<SortedId>& ids, std::string_view prefix) const;
+};
@@ -1,5 +1,38 @@
 #include "test_example_functions.h"
 
+namespace {
+    void Check(bool condition, string_view hint) {
+        if (!condition) {
+            throw logic_error("Check failed: "s + string(hint));
+        }
+    }
+
+    template <typename Exception, typename Function>
+    bool IsThrown(Function function) {
+        try {
+            function();
+        }
+        catch (const Exception&) {
+            return true;
+        }
+        return false;
+    }
+
+    vector<int> GetIds(const vector<Document>& documents) {
+        vector<int> ids;
+        for (const Document& document : documents) {
+            ids.push_back(document.id);
+        }
+        return ids;
+    }
+
+    vector<int> GetSortedIds(const vector<Document>& documents) {
+        vector<int> ids = GetIds(documents);
+        sort(ids.begin(), ids.end());
+        return ids;
+    }
+}
+
 void AddDocument(SearchServer& searchServer, int document_id, const string& document, DocumentStatus status,
                  const vector<int>& ratings) {
     searchServer.AddDocument(document_id, document, status, ratings);
@@ -159,3 +192,175 @@ void test_par_joined() {
         cout << "Document "s << document.id << " matched with relevance "s << document.relevance << endl;
     }
 }
+
+void test_remove_and_compact() {
+    SearchServer search_server("and with"s);
+    search_server.SetAutoCompaction(false);
+    AddDocument(search_server, 1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    AddDocument(search_server, 2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    AddDocument(search_server, 3, "nasty dog"s, DocumentStatus::ACTUAL, {3});
+
+    const auto [words, status] = search_server.MatchDocument("curly hair"s, 2);
+    search_server.RemoveDocument(2);
+    // Removal only leaves a tombstone, so the word views are still valid
+    Check(words == vector<string_view>{"curly"sv, "hair"sv}, "words matched before removal"sv);
+    Check(search_server.GetDocumentCount() == 2, "document count after removal"sv);
+    Check(search_server.FindTopDocuments("curly hair"s).empty(), "removed document is not found"sv);
+    Check(IsThrown<out_of_range>([&search_server] { search_server.MatchDocument("curly"s, 2); }),
+          "matching a removed document throws"sv);
+
+    // Views are taken anew after compaction, which rebuilds the dictionary
+    search_server.Compact();
+    Check(vector<int>(search_server.begin(), search_server.end()) == vector<int>{1, 3}, "ids after compaction"sv);
+    const map<string_view, double> frequencies = search_server.GetWordFrequencies(3);
+    Check(frequencies.size() == 2 && frequencies.count("dog"sv) == 1 && frequencies.count("nasty"sv) == 1,
+          "words of a renumbered document"sv);
+    Check(GetIds(search_server.FindTopDocuments("rat dog"s)) == vector<int>{3, 1}, "query after compaction"sv);
+    Check(search_server.FindTopDocuments("curly"s).empty(), "dropped word is absent"sv);
+    AddDocument(search_server, 4, "curly cat"s, DocumentStatus::ACTUAL, {1});
+    Check(GetIds(search_server.FindTopDocuments("curly"s)) == vector<int>{4}, "document added after compaction"sv);
+}
+
+void test_required_words() {
+    SearchServer search_server("and with"s);
+    AddDocument(search_server, 1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    AddDocument(search_server, 2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    AddDocument(search_server, 3, "nasty dog with curly tail"s, DocumentStatus::ACTUAL, {3});
+    AddDocument(search_server, 4, "curly cat"s, DocumentStatus::BANNED, {5});
+
+    // Required words filter, the other words still add relevance
+    Check(GetIds(search_server.FindTopDocuments("+curly funny"s)) == vector<int>{2, 3}, "one required word"sv);
+    Check(GetIds(search_server.FindTopDocuments("+curly +funny"s)) == vector<int>{2}, "two required words"sv);
+    Check(GetIds(search_server.FindTopDocuments("+curly -hair"s)) == vector<int>{3}, "required and minus words"sv);
+    Check(GetIds(search_server.FindTopDocuments("+curly"s, DocumentStatus::BANNED)) == vector<int>{4},
+          "required word with a status"sv);
+    Check(GetIds(search_server.FindTopDocuments(execution::par, "funny +pet"s)) == vector<int>{1, 2},
+          "required word in a parallel query"sv);
+
+    // A required word no document contains leaves nothing to match
+    Check(search_server.FindTopDocuments("funny +parrot"s).empty(), "absent required word"sv);
+    Check(search_server.FindTopDocuments(execution::par, "funny +parrot"s).empty(),
+          "absent required word in a parallel query"sv);
+    Check(search_server.FindTopDocuments(QueryMode::MAX_SCORE, "funny +parrot"s, DocumentStatus::ACTUAL).empty(),
+          "absent required word in MAX_SCORE mode"sv);
+
+    Check(get<0>(search_server.MatchDocument("+curly funny"s, 1)).empty(), "match without the required word"sv);
+    Check(get<0>(search_server.MatchDocument("+curly funny"s, 2)) == vector<string_view>{"curly"sv, "funny"sv},
+          "match with the required word"sv);
+    Check(IsThrown<invalid_argument>([&search_server] { search_server.FindTopDocuments("++curly"s); }),
+          "double plus throws"sv);
+    Check(IsThrown<invalid_argument>([&search_server] { search_server.FindTopDocuments("funny +"s); }),
+          "plus without word throws"sv);
+}
+
+void test_boolean_queries() {
+    SearchServer search_server("and with"s);
+    AddDocument(search_server, 1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    AddDocument(search_server, 2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    AddDocument(search_server, 3, "nasty dog with curly tail"s, DocumentStatus::ACTUAL, {3});
+    AddDocument(search_server, 4, "big cat"s, DocumentStatus::ACTUAL, {5});
+
+    Check(GetSortedIds(search_server.FindTopDocuments("funny AND curly"s)) == vector<int>{2}, "AND"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("funny OR dog"s)) == vector<int>{1, 2, 3}, "OR"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("funny AND NOT curly"s)) == vector<int>{1}, "AND NOT"sv);
+    // NOT binds tighter than AND, and AND tighter than OR
+    Check(GetSortedIds(search_server.FindTopDocuments("NOT nasty AND curly"s)) == vector<int>{2},
+          "NOT before AND"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("cat OR funny AND curly"s)) == vector<int>{2, 4},
+          "AND before OR"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("(cat OR funny) AND curly"s)) == vector<int>{2},
+          "parentheses"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("NOT (nasty AND curly)"s)) == vector<int>{1, 2, 4},
+          "NOT of parentheses"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("cat dog AND tail"s)) == vector<int>{3, 4},
+          "implicit OR"sv);
+    Check(get<0>(search_server.MatchDocument("funny AND NOT curly"s, 1)) == vector<string_view>{"funny"sv},
+          "boolean match"sv);
+    Check(get<0>(search_server.MatchDocument("funny AND NOT curly"s, 2)).empty(), "boolean mismatch"sv);
+
+    // Malformed boolean syntax leaves a plain query, where operators are ordinary words
+    Check(GetSortedIds(search_server.FindTopDocuments("cat AND"s)) == vector<int>{4}, "missing operand"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("nasty NOT"s)) == vector<int>{1, 3}, "trailing NOT"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("(cat OR funny"s)) == vector<int>{1, 2},
+          "unbalanced parentheses"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("cat OR -funny"s)) == vector<int>{4}, "plain minus word"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("curly +tail OR cat"s)) == vector<int>{3},
+          "plain required word"sv);
+}
+
+void test_phrase_queries() {
+    SearchServer search_server("and with"s);
+    search_server.SetPositionalIndex(true);
+    AddDocument(search_server, 1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    AddDocument(search_server, 2, "nasty pet with funny rat"s, DocumentStatus::ACTUAL, {1, 2});
+    AddDocument(search_server, 3, "big  funny pet"s, DocumentStatus::ACTUAL, {3});
+
+    Check(GetSortedIds(search_server.FindTopDocuments("\"funny pet\""s)) == vector<int>{1, 3}, "phrase"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("\"funny rat\""s)) == vector<int>{2}, "adjacent words"sv);
+    Check(search_server.FindTopDocuments("\"pet funny\""s).empty(), "word order"sv);
+    // A stop word stands for any one word, an empty word for none
+    Check(GetSortedIds(search_server.FindTopDocuments("\"pet and nasty\""s)) == vector<int>{1},
+          "stop word in a phrase"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("\"pet with nasty\""s)) == vector<int>{1},
+          "other stop word in a phrase"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("\"big funny\""s)) == vector<int>{3}, "empty word"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("\"funny pet\" AND NOT big"s)) == vector<int>{1},
+          "phrase in a boolean query"sv);
+    Check(get<0>(search_server.MatchDocument("\"funny pet\""s, 1)) == vector<string_view>{"funny"sv, "pet"sv},
+          "phrase match"sv);
+    Check(get<0>(search_server.MatchDocument("\"funny pet\""s, 2)).empty(), "phrase mismatch"sv);
+
+    Check(!IsThrown<invalid_argument>([&search_server] { search_server.SetPositionalIndex(true); }),
+          "enabling again is allowed"sv);
+    // Positions of documents added before enabling could not be recorded
+    SearchServer unpositioned_server("and with"s);
+    AddDocument(unpositioned_server, 1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    Check(IsThrown<invalid_argument>([&unpositioned_server] { unpositioned_server.SetPositionalIndex(true); }),
+          "enabling on a non-empty index throws"sv);
+    Check(IsThrown<invalid_argument>([&unpositioned_server] {
+              unpositioned_server.FindTopDocuments("\"funny pet\""s);
+          }), "phrase without the positional index throws"sv);
+    search_server.SetPositionalIndex(false);
+    Check(IsThrown<invalid_argument>([&search_server] { search_server.FindTopDocuments("\"funny pet\""s); }),
+          "phrase after disabling throws"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("funny AND pet"s)) == vector<int>{1, 2, 3},
+          "boolean query without phrases after disabling"sv);
+}
+
+void test_prefix_queries() {
+    SearchServer search_server("and with"s);
+    AddDocument(search_server, 1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    AddDocument(search_server, 2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    AddDocument(search_server, 3, "nasty dog with curly tail"s, DocumentStatus::ACTUAL, {3});
+    AddDocument(search_server, 4, "big cat"s, DocumentStatus::ACTUAL, {5});
+
+    Check(GetSortedIds(search_server.FindTopDocuments("cur*"s)) == vector<int>{2, 3}, "prefix"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("pe* ca*"s)) == vector<int>{1, 2, 4}, "two prefixes"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("fun* -cur*"s)) == vector<int>{1}, "excluded prefix"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("nasty -cu*"s)) == vector<int>{1}, "only excluded prefix"sv);
+    Check(search_server.FindTopDocuments("parrot*"s).empty(), "prefix of no word"sv);
+    Check(GetSortedIds(search_server.FindTopDocuments("fun* AND NOT cur*"s)) == vector<int>{1},
+          "prefix under NOT"sv);
+    Check(get<0>(search_server.MatchDocument("cur* funny"s, 2)) == vector<string_view>{"curly"sv, "funny"sv},
+          "prefix match"sv);
+    Check(get<0>(search_server.MatchDocument("funny -cur*"s, 2)).empty(), "excluded prefix match"sv);
+    Check(IsThrown<invalid_argument>([&search_server] { search_server.FindTopDocuments("+cur*"s); }),
+          "required prefix throws"sv);
+    Check(IsThrown<invalid_argument>([&search_server] { search_server.FindTopDocuments("funny *"s); }),
+          "asterisk without word throws"sv);
+
+    // Prefixes that add relevance expand to a bounded number of words,
+    // exclusions to all of them
+    for (int id = 100; id < 400; ++id) {
+        AddDocument(search_server, id, "spam"s + to_string(id) + " filler"s, DocumentStatus::ACTUAL, {1});
+    }
+    const auto any_document = [](int, DocumentStatus, int) {
+        return true;
+    };
+    Check(search_server.FindTopDocuments(execution::seq, "spam*"s, any_document, 1000, 0).size() == 256,
+          "bounded expansion"sv);
+    Check(search_server.FindTopDocuments("filler -spam*"s).empty(), "complete exclusion"sv);
+    Check(search_server.FindTopDocuments("filler AND NOT spam*"s).empty(), "complete exclusion under NOT"sv);
+    Check(search_server.FindTopDocuments(execution::seq, "NOT NOT spam*"s, any_document, 1000, 0).size() == 256,
+          "bounded expansion under two NOT"sv);
+}
@@ -13,4 +13,14 @@ void getFreqWordsOnId();
 
 void erase_duplicates();
 
-void test_par_joined();
\ No newline at end of file
+void test_par_joined();
+
+void test_remove_and_compact();
+
+void test_required_words();
+
+void test_boolean_queries();
+
+void test_phrase_queries();
+
+void test_prefix_queries();
@@ -0,0 +1,23 @@
+#include "text_arena.h"
+#include <algorithm>
+
+std::string_view TextArena::Store(std::string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    // Long strings get a chunk of their own so the current chunk keeps its tail
+    if (text.size() > CHUNK_SIZE / 4) {
+        auto& chunk = *chunks_.insert(chunks_.end() - std::min<size_t>(chunks_.size(), 1),
+                                      std::make_unique<char[]>(text.size()));
+        std::copy(text.begin(), text.end(), chunk.get());
+        return {chunk.get(), text.size()};
+    }
+    if (chunk_used_ + text.size() > CHUNK_SIZE) {
+        chunks_.push_back(std::make_unique<char[]>(CHUNK_SIZE));
+        chunk_used_ = 0;
+    }
+    char* const data = chunks_.back().get() + chunk_used_;
+    std::copy(text.begin(), text.end(), data);
+    chunk_used_ += text.size();
+    return {data, text.size()};
+}
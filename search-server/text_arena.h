@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Append-only storage for short strings. Text is copied into large chunks
+// instead of one heap allocation per string, and stored views stay valid
+// for the lifetime of the arena, including after it is moved.
+// Memory is only given back by dropping the whole arena.
+class TextArena {
+public:
+    std::string_view Store(std::string_view text);
+
+private:
+    inline static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    size_t chunk_used_ = CHUNK_SIZE;
+};